@@ -75,6 +75,7 @@ extern PGDLLEXPORT Datum orafce_to_char_float8(PG_FUNCTION_ARGS);
 extern PGDLLEXPORT Datum orafce_to_char_numeric(PG_FUNCTION_ARGS);
 extern PGDLLEXPORT Datum orafce_to_char_timestamp(PG_FUNCTION_ARGS);
 extern PGDLLEXPORT Datum orafce_to_number(PG_FUNCTION_ARGS);
+extern PGDLLEXPORT Datum orafce_to_number_nls(PG_FUNCTION_ARGS);
 extern PGDLLEXPORT Datum orafce_to_multi_byte(PG_FUNCTION_ARGS);
 extern PGDLLEXPORT Datum orafce_to_single_byte(PG_FUNCTION_ARGS);
 
@@ -191,9 +192,11 @@ extern PGDLLEXPORT Datum plvdate_default_holidays(PG_FUNCTION_ARGS);
 extern PGDLLEXPORT Datum plvdate_version(PG_FUNCTION_ARGS);
 extern PGDLLEXPORT Datum plvdate_days_inmonth(PG_FUNCTION_ARGS);
 extern PGDLLEXPORT Datum plvdate_isleapyear(PG_FUNCTION_ARGS);
+extern PGDLLEXPORT Datum plvdate_calendar_changed(PG_FUNCTION_ARGS);
 
 /* from plvlec.c */
 extern PGDLLEXPORT Datum plvlex_tokens(PG_FUNCTION_ARGS);
+extern PGDLLEXPORT Datum plvlex_fingerprint(PG_FUNCTION_ARGS);
 
 /* from plvstr.c */
 extern PGDLLEXPORT Datum plvstr_rvrs(PG_FUNCTION_ARGS);
@@ -256,6 +259,8 @@ extern PGDLLEXPORT Datum dbms_random_value_range(PG_FUNCTION_ARGS);
 /* from utility.c */
 extern PGDLLEXPORT Datum dbms_utility_format_call_stack0(PG_FUNCTION_ARGS);
 extern PGDLLEXPORT Datum dbms_utility_format_call_stack1(PG_FUNCTION_ARGS);
+extern PGDLLEXPORT Datum dbms_utility_call_stack_depth(PG_FUNCTION_ARGS);
+extern PGDLLEXPORT Datum dbms_utility_call_stack(PG_FUNCTION_ARGS);
 
 /* from oraguc.c */
 extern void PGDLLEXPORT _PG_init(void);
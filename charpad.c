@@ -25,6 +25,92 @@
 PG_FUNCTION_INFO_V1(orafce_lpad);
 PG_FUNCTION_INFO_V1(orafce_rpad);
 
+/*
+ * Returns true when all bytes are printable ASCII chars. These chars have
+ * one byte and display width 1 in all server encodings.
+ */
+static bool
+is_printable_ascii(const char *str, int len)
+{
+	int		i;
+	bool	result = true;
+
+	/* no early exit, so the compiler can vectorize this loop */
+	for (i = 0; i < len; i++)
+		result &= (unsigned char) (str[i] - 0x20) < 0x5f;
+
+	return result;
+}
+
+/*
+ * Fast path for usual case - string and filler are printable ASCII, so
+ * display width is same as byte length. The filler is copied by memset
+ * or by doubling already copied block. Returns NULL, when the fast path
+ * cannot be used.
+ */
+static text *
+ascii_pad(text *string1, int32 output_width, text *string2, bool left)
+{
+	int		s1blen = VARSIZE_ANY_EXHDR(string1);
+	int		s2blen = VARSIZE_ANY_EXHDR(string2);
+	int		s1_add_blen;
+	int		s2_add_blen;
+	char   *ptr_ret;
+	char   *fill;
+	text   *ret;
+
+	/* same behavior as Oracle database */
+	if (s2blen == 0)
+		output_width = 0;
+
+	s1_add_blen = Min(s1blen, output_width);
+	s2_add_blen = output_width - s1_add_blen;
+
+	/* only the used part of string1 has to be checked */
+	if (!is_printable_ascii(VARDATA_ANY(string1), s1_add_blen))
+		return NULL;
+	if (s2_add_blen > 0 &&
+		!is_printable_ascii(VARDATA_ANY(string2), Min(s2blen, s2_add_blen)))
+		return NULL;
+
+	ret = (text *) palloc(VARHDRSZ + output_width);
+	ptr_ret = VARDATA(ret);
+
+	if (left)
+	{
+		fill = ptr_ret;
+		memcpy(ptr_ret + s2_add_blen, VARDATA_ANY(string1), s1_add_blen);
+	}
+	else
+	{
+		memcpy(ptr_ret, VARDATA_ANY(string1), s1_add_blen);
+		fill = ptr_ret + s1_add_blen;
+	}
+
+	if (s2_add_blen > 0)
+	{
+		if (s2blen == 1)
+			memset(fill, *VARDATA_ANY(string2), s2_add_blen);
+		else
+		{
+			int		filled = Min(s2blen, s2_add_blen);
+
+			memcpy(fill, VARDATA_ANY(string2), filled);
+			while (filled < s2_add_blen)
+			{
+				int		n = Min(filled, s2_add_blen - filled);
+
+				memcpy(fill + filled, fill, n);
+				filled += n;
+			}
+		}
+	}
+
+	SET_VARSIZE(ret, VARHDRSZ + output_width);
+
+	return ret;
+}
+
 /*
  * orafce_lpad(string text, length int32 [, fill text])
  *
@@ -64,6 +150,10 @@ orafce_lpad(PG_FUNCTION_ARGS)
 	if (output_width > PAD_MAX)
 		output_width = PAD_MAX;
 
+	ret = ascii_pad(string1, output_width, string2, true);
+	if (ret != NULL)
+		PG_RETURN_TEXT_P(ret);
+
 	/* get byte-length of the 1st and 3rd argument strings */
 	s1blen = VARSIZE_ANY_EXHDR(string1);
 	s2blen = VARSIZE_ANY_EXHDR(string2);
@@ -294,6 +384,10 @@ orafce_rpad(PG_FUNCTION_ARGS)
 	if (output_width > PAD_MAX)
 		output_width = PAD_MAX;
 
+	ret = ascii_pad(string1, output_width, string2, false);
+	if (ret != NULL)
+		PG_RETURN_TEXT_P(ret);
+
 	/* get byte-length of the 1st and 3rd argument strings */
 	s1blen = VARSIZE_ANY_EXHDR(string1);
 	s2blen = VARSIZE_ANY_EXHDR(string2);
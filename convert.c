@@ -1,8 +1,10 @@
 #include "postgres.h"
+#include "ctype.h"
 #include "fmgr.h"
 #include "lib/stringinfo.h"
 #include "mb/pg_wchar.h"
 #include "utils/builtins.h"
+#include "utils/memutils.h"
 #include "utils/numeric.h"
 #include "utils/pg_locale.h"
 #include "utils/formatting.h"
@@ -17,10 +19,10 @@ PG_FUNCTION_INFO_V1(orafce_to_char_float8);
 PG_FUNCTION_INFO_V1(orafce_to_char_numeric);
 PG_FUNCTION_INFO_V1(orafce_to_char_timestamp);
 PG_FUNCTION_INFO_V1(orafce_to_number);
+PG_FUNCTION_INFO_V1(orafce_to_number_nls);
 PG_FUNCTION_INFO_V1(orafce_to_multi_byte);
 PG_FUNCTION_INFO_V1(orafce_to_single_byte);
 
-static int getindex(const char **map, char *mbchar, int mblen);
 
 Datum
 orafce_to_char_int4(PG_FUNCTION_ARGS)
@@ -147,28 +149,209 @@ orafce_to_char_timestamp(PG_FUNCTION_ARGS)
 	PG_RETURN_TEXT_P(result);
 }
 
+/*
+ * PGLC_localeconv result is cached by backend and it is invalidated when
+ * lc_numeric is changed, so it is cheap to call it for every row. The
+ * string is translated in one pass together with the copy to C string,
+ * and the translation is skipped for default separators.
+ */
 Datum
 orafce_to_number(PG_FUNCTION_ARGS)
 {
 	text	   *arg0 = PG_GETARG_TEXT_PP(0);
 	char	   *buf;
 	struct lconv *lconv = PGLC_localeconv();
+	char		decimal_point = lconv->decimal_point[0];
+	char		thousands_sep = lconv->thousands_sep[0];
 	Numeric		res;
-	char	   *p;
 
-	buf = text_to_cstring(arg0);
+	if ((decimal_point == '\0' || decimal_point == '.') &&
+		(thousands_sep == '\0' || thousands_sep == ','))
+		buf = text_to_cstring(arg0);
+	else
+	{
+		const char *src = VARDATA_ANY(arg0);
+		int			len = VARSIZE_ANY_EXHDR(arg0);
+		int			i;
+
+		buf = palloc(len + 1);
+		for (i = 0; i < len; i++)
+		{
+			char		c = src[i];
 
-	for (p = buf; *p; p++)
-		if (*p == lconv->decimal_point[0] && lconv->decimal_point[0])
-			*p = '.';
-		else if (*p == lconv->thousands_sep[0] && lconv->thousands_sep[0])
-			*p = ',';
+			if (c == decimal_point && decimal_point)
+				c = '.';
+			else if (c == thousands_sep && thousands_sep)
+				c = ',';
+			buf[i] = c;
+		}
+		buf[len] = '\0';
+	}
 
 	res = DatumGetNumeric(DirectFunctionCall3(numeric_in, CStringGetDatum(buf), 0, -1));
 
 	PG_RETURN_NUMERIC(res);
 }
 
+/*
+ * Numeric characters specified by NLS parameter of to_number function.
+ * Parsed parameter is cached in fn_extra.
+ */
+typedef struct
+{
+	char	   *nls;			/* NLS parameter, not null terminated */
+	int			nls_len;
+	char		decimal_point;
+	char		group_sep;
+} NlsNumericChars;
+
+#define NLS_NUMERIC_CHARACTERS		"NLS_NUMERIC_CHARACTERS"
+
+#define INVALID_NLS_PARAMETER(detail) \
+	ereport(ERROR, \
+			(errcode(ERRCODE_INVALID_PARAMETER_VALUE), \
+			 errmsg("invalid NLS parameter string"), \
+			 errdetail(detail)))
+
+/*
+ * Parse NLS parameter in Oracle's format: NLS_NUMERIC_CHARACTERS = 'dg',
+ * where d is decimal character and g is group separator.
+ */
+static void
+parse_nls_numeric_characters(const char *str, int len, NlsNumericChars *nc)
+{
+	const char *p = str;
+	const char *end = str + len;
+	int			kwlen = strlen(NLS_NUMERIC_CHARACTERS);
+
+	while (p < end && isspace((unsigned char) *p))
+		p++;
+
+	if (end - p < kwlen || pg_strncasecmp(p, NLS_NUMERIC_CHARACTERS, kwlen) != 0)
+		INVALID_NLS_PARAMETER("Only NLS_NUMERIC_CHARACTERS parameter is supported.");
+	p += kwlen;
+
+	while (p < end && isspace((unsigned char) *p))
+		p++;
+	if (p >= end || *p++ != '=')
+		INVALID_NLS_PARAMETER("Missing \"=\" after parameter name.");
+	while (p < end && isspace((unsigned char) *p))
+		p++;
+
+	if (end - p < 4 || p[0] != '\'' || p[3] != '\'')
+		INVALID_NLS_PARAMETER("Expected two characters enclosed in quotes.");
+
+	nc->decimal_point = p[1];
+	nc->group_sep = p[2];
+	p += 4;
+
+	while (p < end && isspace((unsigned char) *p))
+		p++;
+	if (p < end)
+		INVALID_NLS_PARAMETER("Unexpected characters after parameter value.");
+
+	if (IS_HIGHBIT_SET(nc->decimal_point) || IS_HIGHBIT_SET(nc->group_sep) ||
+		isdigit((unsigned char) nc->decimal_point) ||
+		isdigit((unsigned char) nc->group_sep) ||
+		nc->decimal_point == nc->group_sep)
+		INVALID_NLS_PARAMETER("Decimal character and group separator should be different non digit ASCII characters.");
+}
+
+static NlsNumericChars *
+get_nls_numeric_chars(FunctionCallInfo fcinfo, text *nls)
+{
+	NlsNumericChars *nc = (NlsNumericChars *) fcinfo->flinfo->fn_extra;
+	char	   *str = VARDATA_ANY(nls);
+	int			len = VARSIZE_ANY_EXHDR(nls);
+
+	if (nc != NULL && nc->nls_len == len && memcmp(nc->nls, str, len) == 0)
+		return nc;
+
+	if (nc == NULL)
+	{
+		nc = MemoryContextAllocZero(fcinfo->flinfo->fn_mcxt,
+									sizeof(NlsNumericChars));
+		fcinfo->flinfo->fn_extra = nc;
+	}
+	else
+	{
+		pfree(nc->nls);
+		nc->nls = NULL;
+		nc->nls_len = -1;
+	}
+
+	parse_nls_numeric_characters(str, len, nc);
+
+	nc->nls = MemoryContextAlloc(fcinfo->flinfo->fn_mcxt, len + 1);
+	memcpy(nc->nls, str, len);
+	nc->nls_len = len;
+
+	return nc;
+}
+
+/*
+ * to_number(str text, fmt text, nls text)
+ *
+ * Characters specified by NLS parameter are translated to current locale
+ * characters, that are used by the D and G format patterns, and the string
+ * is processed by the built-in to_number. The built-in function caches
+ * compiled format pictures.
+ */
+Datum
+orafce_to_number_nls(PG_FUNCTION_ARGS)
+{
+	text	   *arg0 = PG_GETARG_TEXT_PP(0);
+	text	   *fmt = PG_GETARG_TEXT_PP(1);
+	NlsNumericChars *nc = get_nls_numeric_chars(fcinfo, PG_GETARG_TEXT_PP(2));
+	struct lconv *lconv = PGLC_localeconv();
+	const char *decimal_point = lconv->decimal_point;
+	const char *thousands_sep = lconv->thousands_sep;
+	const char *src = VARDATA_ANY(arg0);
+	int			len = VARSIZE_ANY_EXHDR(arg0);
+	int			decimal_len;
+	int			thousands_len;
+	text	   *str;
+	char	   *dest;
+	int			i;
+
+	/* same defaults as NUM_prepare_locale in formatting.c */
+	if (decimal_point == NULL || *decimal_point == '\0')
+		decimal_point = ".";
+	if (thousands_sep == NULL || *thousands_sep == '\0')
+		thousands_sep = strcmp(decimal_point, ",") != 0 ? "," : ".";
+
+	/* the locale symbols can be multibyte, they are copied whole */
+	decimal_len = strlen(decimal_point);
+	thousands_len = strlen(thousands_sep);
+
+	str = palloc(len * Max(decimal_len, thousands_len) + VARHDRSZ);
+	dest = VARDATA(str);
+
+	for (i = 0; i < len; i++)
+	{
+		char		c = src[i];
+
+		if (c == nc->decimal_point)
+		{
+			memcpy(dest, decimal_point, decimal_len);
+			dest += decimal_len;
+		}
+		else if (c == nc->group_sep)
+		{
+			memcpy(dest, thousands_sep, thousands_len);
+			dest += thousands_len;
+		}
+		else
+			*dest++ = c;
+	}
+
+	SET_VARSIZE(str, dest - (char *) str);
+
+	return DirectFunctionCall2(numeric_to_number,
+							   PointerGetDatum(str),
+							   PointerGetDatum(fmt));
+}
+
 /* 3 is enough, but it is defined as 4 in backend code. */
 #ifndef MAX_CONVERSION_GROWTH
 #define MAX_CONVERSION_GROWTH  4
@@ -446,15 +629,81 @@ orafce_to_multi_byte(PG_FUNCTION_ARGS)
 	PG_RETURN_TEXT_P(dst);
 }
 
-static int
-getindex(const char **map, char *mbchar, int mblen)
+/*
+ * Reverse lookup tables for TO_MULTI_BYTE maps. Multibyte chars are packed
+ * to uint32 codes and stored in open addressing hash table, that is built
+ * on first use. The table has more than twice more slots than the map has
+ * entries, so usually only one probe is necessary.
+ */
+#define REVMAP_SIZE		256
+
+#define REVMAP_HASH(code)	(((uint32) (code) * 2654435761U) >> 24)
+
+typedef struct
+{
+	uint32		code[REVMAP_SIZE];		/* 0 is empty slot */
+	int8		index[REVMAP_SIZE];
+} RevMap;
+
+static RevMap *revmap_utf8 = NULL;
+static RevMap *revmap_eucjp = NULL;
+
+static uint32
+mbchar_code(const char *mbchar, int mblen)
+{
+	uint32		code = 0;
+	int			i;
+
+	for (i = 0; i < mblen; i++)
+		code = (code << 8) | (unsigned char) mbchar[i];
+
+	return code;
+}
+
+static RevMap *
+build_revmap(const char **map)
 {
-	int		i;
+	RevMap	   *revmap;
+	int			i;
+
+	revmap = MemoryContextAllocZero(TopMemoryContext, sizeof(RevMap));
 
 	for (i = 0; i < 95; i++)
 	{
-		if (!memcmp(map[i], mbchar, mblen))
-			return i;
+		uint32		code = mbchar_code(map[i], strlen(map[i]));
+		uint32		h = REVMAP_HASH(code);
+
+		while (revmap->code[h] != 0 && revmap->code[h] != code)
+			h = (h + 1) & (REVMAP_SIZE - 1);
+
+		/* for duplicate chars the first entry wins */
+		if (revmap->code[h] == 0)
+		{
+			revmap->code[h] = code;
+			revmap->index[h] = i;
+		}
+	}
+
+	return revmap;
+}
+
+static int
+getindex(const RevMap *revmap, const char *mbchar, int mblen)
+{
+	uint32		code;
+	uint32		h;
+
+	if (mblen > 4)
+		return -1;
+
+	code = mbchar_code(mbchar, mblen);
+	h = REVMAP_HASH(code);
+
+	while (revmap->code[h] != 0)
+	{
+		if (revmap->code[h] == code)
+			return revmap->index[h];
+		h = (h + 1) & (REVMAP_SIZE - 1);
 	}
 
 	return -1;
@@ -467,18 +716,23 @@ orafce_to_single_byte(PG_FUNCTION_ARGS)
 	text	   *dst;
 	char	   *s;
 	char	   *d;
+	char	   *e;
 	int			srclen;
 	int			dstlen;
-	const char **map;
+	RevMap	   *revmap;
 
 	switch (GetDatabaseEncoding())
 	{
 		case PG_UTF8:
-			map = TO_MULTI_BYTE_UTF8;
+			if (revmap_utf8 == NULL)
+				revmap_utf8 = build_revmap(TO_MULTI_BYTE_UTF8);
+			revmap = revmap_utf8;
 			break;
 		case PG_EUC_JP:
 		case PG_EUC_JIS_2004:
-			map = TO_MULTI_BYTE_EUCJP;
+			if (revmap_eucjp == NULL)
+				revmap_eucjp = build_revmap(TO_MULTI_BYTE_EUCJP);
+			revmap = revmap_eucjp;
 			break;
 		/*
 		 * TODO: Add converter for encodings.
@@ -490,23 +744,34 @@ orafce_to_single_byte(PG_FUNCTION_ARGS)
 	src = PG_GETARG_TEXT_PP(0);
 	s = VARDATA_ANY(src);
 	srclen = VARSIZE_ANY_EXHDR(src);
+	e = s + srclen;
 
 	/* XXX - The output length should be <= input length */
-	dst = (text *) palloc0(VARHDRSZ + srclen);
+	dst = (text *) palloc(VARHDRSZ + srclen);
 	d = VARDATA(dst);
 
-	while (*s && (s - VARDATA_ANY(src) < srclen))
+	while (s < e)
 	{
 		char   *u = s;
 		int		clen;
 		int		mapindex;
 
+		/* ASCII chars are not converted, copy them as block */
+		if (!IS_HIGHBIT_SET(*s))
+		{
+			while (s < e && !IS_HIGHBIT_SET(*s))
+				s++;
+			memcpy(d, u, s - u);
+			d += s - u;
+			continue;
+		}
+
 		clen = pg_mblen(u);
 		s += clen;
 
 		if (clen == 1)
 			*d++ = *u;
-		else if ((mapindex = getindex(map, u, clen)) >= 0)
+		else if ((mapindex = getindex(revmap, u, clen)) >= 0)
 		{
 			const char m = 0x20 + mapindex;
 			*d++ = m;
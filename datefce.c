@@ -8,6 +8,7 @@
 #include "utils/numeric.h"
 #include "utils/formatting.h"
 #include <sys/time.h>
+#include <ctype.h>
 #include "orafce.h"
 #include "builtins.h"
 
@@ -93,6 +94,58 @@ do { \
 	} \
 } while (0)
 
+/*
+ * Format of trunc and round is usually constant, so the resolved
+ * format code is cached in fn_extra.
+ */
+#define DATE_FMT_MAXLEN		8
+
+typedef struct
+{
+	char		fmt[DATE_FMT_MAXLEN];	/* format, not null terminated */
+	int			fmt_len;
+	int			f;					/* index in date_fmt */
+#if defined(WIN32)
+	pg_tz	   *tz;					/* see get_session_timezone */
+#endif
+} DateFmtCache;
+
+static pg_tz *get_session_timezone(FunctionCallInfo fcinfo);
+
+/*
+ * orafce.nls_date_format is compiled by GUC check hook. When the format
+ * is composed only from numeric fields YYYY, MM, DD, HH24, MI, SS and
+ * punctuation, then to_date parses the input itself without to_timestamp.
+ */
+#define NLS_DATE_MAX_ITEMS		16
+
+typedef enum
+{
+	NLS_DATE_YEAR,
+	NLS_DATE_MONTH,
+	NLS_DATE_DAY,
+	NLS_DATE_HOUR,
+	NLS_DATE_MINUTE,
+	NLS_DATE_SECOND,
+	NLS_DATE_SEPARATOR
+} NlsDateItemType;
+
+typedef struct
+{
+	NlsDateItemType type;
+	char		sep;
+} NlsDateItem;
+
+typedef struct
+{
+	text	   *fmt;				/* format as text for to_timestamp */
+	bool		fast;				/* true, when items can be used */
+	int			nitems;
+	NlsDateItem items[NLS_DATE_MAX_ITEMS];
+} NlsDateProgram;
+
+static const NlsDateProgram *nls_date_program = NULL;
+
 PG_FUNCTION_INFO_V1(next_day);
 PG_FUNCTION_INFO_V1(next_day_by_index);
 PG_FUNCTION_INFO_V1(last_day);
@@ -564,6 +617,223 @@ _ora_date_round(DateADT day, int f)
 	return result;
 }
 
+static DateFmtCache *
+get_date_fmt_cache(FunctionCallInfo fcinfo)
+{
+	DateFmtCache *cache = (DateFmtCache *) fcinfo->flinfo->fn_extra;
+
+	if (cache == NULL)
+	{
+		cache = MemoryContextAllocZero(fcinfo->flinfo->fn_mcxt,
+									   sizeof(DateFmtCache));
+		cache->fmt_len = -1;
+		fcinfo->flinfo->fn_extra = cache;
+	}
+
+	return cache;
+}
+
+/*
+ * Returns index of round/trunc format in date_fmt
+ */
+static int
+get_date_fmt(FunctionCallInfo fcinfo, text *fmt)
+{
+	DateFmtCache *cache = get_date_fmt_cache(fcinfo);
+	char	   *str = VARDATA_ANY(fmt);
+	int			len = VARSIZE_ANY_EXHDR(fmt);
+	int			f;
+
+	if (cache->fmt_len == len && memcmp(cache->fmt, str, len) == 0)
+		return cache->f;
+
+	f = ora_seq_search(str, date_fmt, len);
+	CHECK_SEQ_SEARCH(f, "round/trunc format string");
+
+	/* any valid format is short */
+	Assert(len <= DATE_FMT_MAXLEN);
+
+	memcpy(cache->fmt, str, len);
+	cache->fmt_len = len;
+	cache->f = f;
+
+	return f;
+}
+
+static bool
+compile_nls_date_format(const char *fmt, NlsDateProgram *prog)
+{
+	static const struct
+	{
+		const char *name;
+		NlsDateItemType type;
+	} fields[] =
+	{
+		{"YYYY", NLS_DATE_YEAR},
+		{"HH24", NLS_DATE_HOUR},
+		{"MM", NLS_DATE_MONTH},
+		{"DD", NLS_DATE_DAY},
+		{"MI", NLS_DATE_MINUTE},
+		{"SS", NLS_DATE_SECOND},
+		{NULL}
+	};
+	int			used = 0;
+	const char *p = fmt;
+
+	prog->nitems = 0;
+
+	while (*p)
+	{
+		NlsDateItem *item;
+		int			i;
+
+		if (prog->nitems == NLS_DATE_MAX_ITEMS)
+			return false;
+
+		item = &prog->items[prog->nitems];
+
+		if (strchr("-./:, ", *p) != NULL)
+		{
+			/* only single separator between fields */
+			if (prog->nitems == 0 ||
+				item[-1].type == NLS_DATE_SEPARATOR || p[1] == '\0')
+				return false;
+
+			item->type = NLS_DATE_SEPARATOR;
+			item->sep = *p++;
+			prog->nitems++;
+			continue;
+		}
+
+		for (i = 0; fields[i].name; i++)
+		{
+			int			len = strlen(fields[i].name);
+
+			if (pg_strncasecmp(p, fields[i].name, len) == 0)
+				break;
+		}
+
+		/* unsupported field or repeated field */
+		if (fields[i].name == NULL || (used & (1 << fields[i].type)))
+			return false;
+
+		used |= 1 << fields[i].type;
+		item->type = fields[i].type;
+		p += strlen(fields[i].name);
+		prog->nitems++;
+	}
+
+	/* date part has to be complete */
+	return (used & 0x07) == 0x07;
+}
+
+bool
+check_nls_date_format(char **newval, void **extra, GucSource source)
+{
+	NlsDateProgram *prog;
+	int			len;
+
+	if (*newval == NULL || **newval == '\0')
+		return true;
+
+	len = strlen(*newval);
+	prog = guc_malloc(LOG, MAXALIGN(sizeof(NlsDateProgram)) + VARHDRSZ + len);
+	if (prog == NULL)
+		return false;
+
+	prog->fmt = (text *) ((char *) prog + MAXALIGN(sizeof(NlsDateProgram)));
+	SET_VARSIZE(prog->fmt, VARHDRSZ + len);
+	memcpy(VARDATA(prog->fmt), *newval, len);
+
+	prog->fast = compile_nls_date_format(*newval, prog);
+
+	*extra = prog;
+
+	return true;
+}
+
+void
+assign_nls_date_format(const char *newval, void *extra)
+{
+	nls_date_program = (const NlsDateProgram *) extra;
+}
+
+/*
+ * Parse str by compiled format. Returns false, when the string doesn't
+ * exactly match the format or some field is out of range - then the
+ * slow path (to_timestamp) is used, and it raises the correct error.
+ */
+static bool
+parse_nls_date(const NlsDateProgram *prog, const char *str, int len, struct pg_tm *tm)
+{
+	const char *p = str;
+	const char *end = str + len;
+	int			i;
+
+	memset(tm, 0, sizeof(struct pg_tm));
+
+	for (i = 0; i < prog->nitems; i++)
+	{
+		const NlsDateItem *item = &prog->items[i];
+		int			width;
+		int			value = 0;
+
+		if (item->type == NLS_DATE_SEPARATOR)
+		{
+			if (p >= end || *p != item->sep)
+				return false;
+			p++;
+			continue;
+		}
+
+		width = item->type == NLS_DATE_YEAR ? 4 : 2;
+		if (end - p < width)
+			return false;
+
+		while (width-- > 0)
+		{
+			if (!isdigit((unsigned char) *p))
+				return false;
+			value = value * 10 + (*p++ - '0');
+		}
+
+		switch (item->type)
+		{
+			case NLS_DATE_YEAR:
+				tm->tm_year = value;
+				break;
+			case NLS_DATE_MONTH:
+				tm->tm_mon = value;
+				break;
+			case NLS_DATE_DAY:
+				tm->tm_mday = value;
+				break;
+			case NLS_DATE_HOUR:
+				tm->tm_hour = value;
+				break;
+			case NLS_DATE_MINUTE:
+				tm->tm_min = value;
+				break;
+			case NLS_DATE_SECOND:
+				tm->tm_sec = value;
+				break;
+			default:
+				break;
+		}
+	}
+
+	if (p != end)
+		return false;
+
+	return tm->tm_year >= 1 &&
+		   tm->tm_mon >= 1 && tm->tm_mon <= MONTHS_PER_YEAR &&
+		   tm->tm_mday >= 1 &&
+		   tm->tm_mday <= day_tab[isleap(tm->tm_year)][tm->tm_mon - 1] &&
+		   tm->tm_hour < HOURS_PER_DAY &&
+		   tm->tm_min < MINS_PER_HOUR &&
+		   tm->tm_sec < SECS_PER_MINUTE;
+}
+
 /********************************************************************
  *
  * ora_to_date
@@ -584,14 +854,39 @@ ora_to_date(PG_FUNCTION_ARGS)
 	text *date_txt = PG_GETARG_TEXT_PP(0);
 	Timestamp result;
 
-	if(nls_date_format && strlen(nls_date_format))
+	if (nls_date_program != NULL)
 	{
 		Datum newDate;
+		struct pg_tm tt, *tm = &tt;
+
+		if (nls_date_program->fast &&
+			parse_nls_date(nls_date_program, VARDATA_ANY(date_txt),
+						   VARSIZE_ANY_EXHDR(date_txt), tm))
+		{
+			pg_tz *tzp = get_session_timezone(fcinfo);
+			TimestampTz tstz;
+			fsec_t fsec;
+			int tz;
+
+			/*
+			 * Same as to_timestamp and timestamptz_timestamp, so local
+			 * time in DST gap is shifted.
+			 */
+			tz = DetermineTimeZoneOffset(tm, tzp);
+			if (tm2timestamp(tm, 0, &tz, &tstz) != 0 ||
+				timestamp2tm(tstz, &tz, tm, &fsec, NULL, tzp) != 0 ||
+				tm2timestamp(tm, fsec, NULL, &result) != 0)
+				ereport(ERROR,
+						(errcode(ERRCODE_DATETIME_VALUE_OUT_OF_RANGE),
+						 errmsg("timestamp out of range")));
+
+			PG_RETURN_TIMESTAMP(result);
+		}
 
 		/* it will return timestamp at GMT */
 		newDate = DirectFunctionCall2(to_timestamp,
-							CStringGetDatum(date_txt),
-							CStringGetDatum(cstring_to_text(nls_date_format)));
+							PointerGetDatum(date_txt),
+							PointerGetDatum(nls_date_program->fmt));
 
 		/* convert to local timestamp */
 		result = DatumGetTimestamp(DirectFunctionCall1(timestamptz_timestamp, newDate));
@@ -628,8 +923,7 @@ ora_date_trunc(PG_FUNCTION_ARGS)
 
 	DateADT result;
 
-	int f = ora_seq_search(VARDATA_ANY(fmt), date_fmt, VARSIZE_ANY_EXHDR(fmt));
-	CHECK_SEQ_SEARCH(f, "round/trunc format string");
+	int f = get_date_fmt(fcinfo, fmt);
 
 	result = _ora_date_trunc(day, f);
 	PG_RETURN_DATEADT(result);
@@ -639,7 +933,8 @@ ora_date_trunc(PG_FUNCTION_ARGS)
  * Workaround for access to session_timezone on WIN32,
  * 
  * session timezone isn't accessed directly, but taken by show_timezone,
- * and reparsed. For better performance, the result is cached in fn_extra.
+ * and reparsed. For better performance, the result is cached in fn_extra
+ * together with the format.
  *
  */
 static pg_tz *
@@ -647,7 +942,8 @@ get_session_timezone(FunctionCallInfo fcinfo)
 {
 #if defined(WIN32)
 
-	pg_tz *result = (pg_tz *) fcinfo->flinfo->fn_extra;
+	DateFmtCache *cache = get_date_fmt_cache(fcinfo);
+	pg_tz *result = cache->tz;
 
 	if (result == NULL)
 	{
@@ -658,7 +954,7 @@ get_session_timezone(FunctionCallInfo fcinfo)
 			elog(ERROR, "cannot to parse timezone \"%s\"", tzn);
 
 		result = *((pg_tz **) extra);
-		fcinfo->flinfo->fn_extra = result;
+		cache->tz = result;
 
 		/*
 		 * check_timezone allocates small block of pg_tz * size. This block
@@ -685,13 +981,8 @@ get_session_timezone(FunctionCallInfo fcinfo)
  * redotz is used only for timestamp with time zone
  */
 static void
-tm_trunc(struct pg_tm *tm, text *fmt, bool *redotz)
+tm_trunc(struct pg_tm *tm, int f, bool *redotz)
 {
-	int f;
-
-	f = ora_seq_search(VARDATA_ANY(fmt), date_fmt, VARSIZE_ANY_EXHDR(fmt));
-	CHECK_SEQ_SEARCH(f, "round/trunc format string");
-
 	tm->tm_sec = 0;
 
 	switch (f)
@@ -743,7 +1034,7 @@ ora_timestamptz_trunc(PG_FUNCTION_ARGS)
 					(errcode(ERRCODE_DATETIME_VALUE_OUT_OF_RANGE),
 					 errmsg("timestamp out of range")));
 
-	tm_trunc(tm, fmt, &redotz);
+	tm_trunc(tm, get_date_fmt(fcinfo, fmt), &redotz);
 	fsec = 0;
 
 	if (redotz)
@@ -781,8 +1072,7 @@ ora_date_round(PG_FUNCTION_ARGS)
 
 	DateADT result;
 
-	int f = ora_seq_search(VARDATA_ANY(fmt), date_fmt, VARSIZE_ANY_EXHDR(fmt));
-	CHECK_SEQ_SEARCH(f, "round/trunc format string");
+	int f = get_date_fmt(fcinfo, fmt);
 
 	result = _ora_date_round(day, f);
 	PG_RETURN_DATEADT(result);
@@ -794,14 +1084,10 @@ ora_date_round(PG_FUNCTION_ARGS)
 	do { if (rounded) _tm_->tm_mday += _tm_->tm_hour >= 12?1:0; } while(0)
 
 static void
-tm_round(struct pg_tm *tm, text *fmt, bool *redotz)
+tm_round(struct pg_tm *tm, int f, bool *redotz)
 {
-	int 	f;
 	bool	rounded = true;
 
-	f = ora_seq_search(VARDATA_ANY(fmt), date_fmt, VARSIZE_ANY_EXHDR(fmt));
-	CHECK_SEQ_SEARCH(f, "round/trunc format string");
-
 	/* set rounding rule */
 	switch (f)
 	{
@@ -900,7 +1186,7 @@ ora_timestamptz_round(PG_FUNCTION_ARGS)
 					(errcode(ERRCODE_DATETIME_VALUE_OUT_OF_RANGE),
 					 errmsg("timestamp out of range")));
 
-	tm_round(tm, fmt, &redotz);
+	tm_round(tm, get_date_fmt(fcinfo, fmt), &redotz);
 
 	if (redotz)
 		tz = DetermineTimeZoneOffset(tm, get_session_timezone(fcinfo));
@@ -913,6 +1199,60 @@ ora_timestamptz_round(PG_FUNCTION_ARGS)
 	PG_RETURN_TIMESTAMPTZ(result);
 }
 
+#if defined(HAVE_INT64_TIMESTAMP) || PG_VERSION_NUM >= 100000
+
+/* 0001-01-01, the result of fast trunc is surely in timestamp range */
+#define TRUNC_FAST_MIN_DAY		(1721426 - POSTGRES_EPOCH_JDATE)
+
+static inline int64
+floor_mod(int64 a, int64 b)
+{
+	int64 r = a % b;
+
+	return r < 0 ? r + b : r;
+}
+
+/*
+ * Fast trunc of timestamp without time zone. It works directly with int64
+ * timestamp (without timestamp2tm and tm2timestamp). Returns false, when
+ * there is not fast path for the format.
+ */
+static bool
+timestamp_trunc_fast(Timestamp timestamp, int f, Timestamp *result)
+{
+	int64 day;
+
+	switch (f)
+	{
+	CASE_fmt_MI
+		*result = timestamp - floor_mod(timestamp, USECS_PER_MINUTE);
+		return true;
+	CASE_fmt_HH
+		*result = timestamp - floor_mod(timestamp, USECS_PER_HOUR);
+		return true;
+	CASE_fmt_DDD
+		*result = timestamp - floor_mod(timestamp, USECS_PER_DAY);
+		return true;
+	CASE_fmt_YYYY
+	CASE_fmt_IYYY
+	CASE_fmt_Q
+	CASE_fmt_WW
+	CASE_fmt_IW
+	CASE_fmt_W
+	CASE_fmt_DAY
+	CASE_fmt_MON
+		day = (timestamp - floor_mod(timestamp, USECS_PER_DAY)) / USECS_PER_DAY;
+		if (day < TRUNC_FAST_MIN_DAY)
+			return false;
+		*result = (Timestamp) _ora_date_trunc((DateADT) day, f) * USECS_PER_DAY;
+		return true;
+	}
+
+	return false;
+}
+
+#endif
+
 Datum
 ora_timestamp_trunc(PG_FUNCTION_ARGS)
 {
@@ -922,16 +1262,24 @@ ora_timestamp_trunc(PG_FUNCTION_ARGS)
 	fsec_t fsec;
 	struct pg_tm tt, *tm = &tt;
 	bool redotz = false;
+	int f;
 
 	if (TIMESTAMP_NOT_FINITE(timestamp))
 		PG_RETURN_TIMESTAMP(timestamp);
 
+	f = get_date_fmt(fcinfo, fmt);
+
+#if defined(HAVE_INT64_TIMESTAMP) || PG_VERSION_NUM >= 100000
+	if (timestamp_trunc_fast(timestamp, f, &result))
+		PG_RETURN_TIMESTAMP(result);
+#endif
+
 	if (timestamp2tm(timestamp, NULL, tm, &fsec, NULL, NULL) != 0)
 		ereport(ERROR,
 					(errcode(ERRCODE_DATETIME_VALUE_OUT_OF_RANGE),
 					 errmsg("timestamp out of range")));
 
-	tm_trunc(tm, fmt, &redotz);
+	tm_trunc(tm, f, &redotz);
 	fsec = 0;
 
 	if (tm2timestamp(tm, fsec, NULL, &result) != 0)
@@ -960,7 +1308,7 @@ ora_timestamp_round(PG_FUNCTION_ARGS)
 					(errcode(ERRCODE_DATETIME_VALUE_OUT_OF_RANGE),
 					 errmsg("timestamp out of range")));
 
-	tm_round(tm, fmt, &redotz);
+	tm_round(tm, get_date_fmt(fcinfo, fmt), &redotz);
 
 	if (tm2timestamp(tm, fsec, NULL, &result) != 0)
 		ereport(ERROR,
@@ -989,20 +1337,44 @@ ora_timestamp_round(PG_FUNCTION_ARGS)
 Datum
 orafce_sysdate(PG_FUNCTION_ARGS)
 {
-	Datum sysdate;
-	Datum sysdate_scaled;
+	/* sysdate is same for whole statement, last result is remembered */
+	static TimestampTz last_stmt_start = 0;
+	static pg_tz *last_tz = NULL;
+	static Timestamp last_sysdate;
+
+	TimestampTz stmt_start = GetCurrentStatementStartTimestamp();
+	Timestamp result;
+	struct pg_tm tt, *tm = &tt;
+	fsec_t fsec;
+	int tz;
 
+	if (last_tz != NULL && last_tz == orafce_tz && last_stmt_start == stmt_start)
+		PG_RETURN_TIMESTAMP(last_sysdate);
 
-	sysdate = DirectFunctionCall2(timestamptz_zone,
-					CStringGetTextDatum(orafce_timezone),
-					TimestampTzGetDatum(GetCurrentStatementStartTimestamp()));
+	/* orafce.timezone was parsed to pg_tz already by GUC check hook */
+	if (timestamp2tm(stmt_start, &tz, tm, &fsec, NULL, orafce_tz) != 0 ||
+		tm2timestamp(tm, fsec, NULL, &result) != 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATETIME_VALUE_OUT_OF_RANGE),
+				 errmsg("timestamp out of range")));
 
-	/* necessary to cast to timestamp(0) to emulate Oracle's date */
-	sysdate_scaled = DirectFunctionCall2(timestamp_scale,
-						sysdate,
-						Int32GetDatum(0));
+	/* necessary to round to timestamp(0) to emulate Oracle's date */
+#if defined(HAVE_INT64_TIMESTAMP) || PG_VERSION_NUM >= 100000
+	if (result >= 0)
+		result = ((result + USECS_PER_SEC / 2) / USECS_PER_SEC) * USECS_PER_SEC;
+	else
+		result = -(((-result + USECS_PER_SEC / 2) / USECS_PER_SEC) * USECS_PER_SEC);
+#else
+	result = DatumGetTimestamp(DirectFunctionCall2(timestamp_scale,
+												   TimestampGetDatum(result),
+												   Int32GetDatum(0)));
+#endif
 
-	PG_RETURN_DATUM(sysdate_scaled);
+	last_stmt_start = stmt_start;
+	last_tz = orafce_tz;
+	last_sysdate = result;
+
+	PG_RETURN_TIMESTAMP(result);
 }
 
 /********************************************************************
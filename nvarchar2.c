@@ -55,7 +55,7 @@ nvarchar2_input(const char *s, size_t len, int32 atttypmod)
 		 *
 		 * NOTE: blankspace is not truncated
 		 */
-		size_t		mbmaxlen = pg_mbstrlen(s);
+		size_t		mbmaxlen = ora_mbstrlen_with_len(s, len);
 
 		if (mbmaxlen > maxlen)
 			ereport(ERROR,
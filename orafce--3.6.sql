@@ -1,4 +1,4 @@
-/* contrib/orafce--3.4.sql */
+/* contrib/orafce--3.6.sql */
 
 -- complain if script is sourced in psql, rather than via CREATE EXTENSION
 \echo Use "CREATE EXTENSION orafce" to load this file. \quit
@@ -169,6 +169,12 @@ RETURNS numeric AS $$
 SELECT pg_catalog.to_number($1::text,$2::text);
 $$ LANGUAGE SQL IMMUTABLE;
 
+CREATE FUNCTION pg_catalog.to_number(str text, fmt text, nls text)
+RETURNS numeric
+AS 'MODULE_PATHNAME','orafce_to_number_nls'
+LANGUAGE C STABLE STRICT;
+COMMENT ON FUNCTION pg_catalog.to_number(text, text, text) IS 'Convert string to number with format and NLS_NUMERIC_CHARACTERS';
+
 CREATE FUNCTION pg_catalog.to_date(str text)
 RETURNS timestamp
 AS 'MODULE_PATHNAME','ora_to_date'
@@ -247,6 +253,11 @@ RETURNS varchar
 AS 'MODULE_PATHNAME', 'orafce_dump'
 LANGUAGE C;
 
+CREATE FUNCTION dump("any", integer, integer, integer)
+RETURNS varchar
+AS 'MODULE_PATHNAME', 'orafce_dump'
+LANGUAGE C;
+
 CREATE SCHEMA plvstr;
 
 CREATE FUNCTION plvstr.rvrs(str text, start int, _end int)
@@ -269,8 +280,8 @@ COMMENT ON FUNCTION plvstr.rvrs(text) IS 'Reverse string or part of string';
 
 CREATE FUNCTION pg_catalog.lnnvl(bool)
 RETURNS bool
-AS 'MODULE_PATHNAME','ora_lnnvl'
-LANGUAGE C IMMUTABLE;
+AS $$ SELECT $1 IS NOT TRUE; $$
+LANGUAGE sql IMMUTABLE;
 COMMENT ON FUNCTION pg_catalog.lnnvl(bool) IS '';
 
 -- can't overwrite PostgreSQL functions!!!!
@@ -539,15 +550,18 @@ COMMENT ON FUNCTION dbms_output.get_lines(OUT text[], INOUT int4) IS 'Get lines
 
 CREATE FUNCTION nvl(anyelement, anyelement)
 RETURNS anyelement
-AS 'MODULE_PATHNAME','ora_nvl'
-LANGUAGE C IMMUTABLE;
+AS $$ SELECT COALESCE($1, $2); $$
+LANGUAGE sql IMMUTABLE;
 
 CREATE FUNCTION nvl2(anyelement, anyelement, anyelement)
 RETURNS anyelement
-AS 'MODULE_PATHNAME','ora_nvl2'
-LANGUAGE C IMMUTABLE;
+AS $$ SELECT CASE WHEN $1 IS NOT NULL THEN $2 ELSE $3 END; $$
+LANGUAGE sql IMMUTABLE;
 COMMENT ON FUNCTION nvl2(anyelement, anyelement, anyelement) IS '';
 
+-- decode stays C function, SQL CASE body references lhs in every branch and
+-- is not inlined for expensive lhs. Search arguments are compared by linear
+-- scan with the equality function cached in fn_extra.
 CREATE FUNCTION decode(anyelement, anyelement, text)
 RETURNS text
 AS 'MODULE_PATHNAME', 'ora_decode'
@@ -578,6 +592,77 @@ RETURNS text
 AS 'MODULE_PATHNAME', 'ora_decode'
 LANGUAGE C IMMUTABLE;
 
+-- more search pairs, the search list of constants is hashed from 8 pairs
+CREATE FUNCTION decode(anyelement, anyelement, text, anyelement, text, anyelement, text, anyelement, text)
+RETURNS text
+AS 'MODULE_PATHNAME', 'ora_decode'
+LANGUAGE C IMMUTABLE;
+
+CREATE FUNCTION decode(anyelement, anyelement, text, anyelement, text, anyelement, text, anyelement, text, text)
+RETURNS text
+AS 'MODULE_PATHNAME', 'ora_decode'
+LANGUAGE C IMMUTABLE;
+
+CREATE FUNCTION decode(anyelement, anyelement, text, anyelement, text, anyelement, text, anyelement, text, anyelement, text)
+RETURNS text
+AS 'MODULE_PATHNAME', 'ora_decode'
+LANGUAGE C IMMUTABLE;
+
+CREATE FUNCTION decode(anyelement, anyelement, text, anyelement, text, anyelement, text, anyelement, text, anyelement, text, text)
+RETURNS text
+AS 'MODULE_PATHNAME', 'ora_decode'
+LANGUAGE C IMMUTABLE;
+
+CREATE FUNCTION decode(anyelement, anyelement, text, anyelement, text, anyelement, text, anyelement, text, anyelement, text, anyelement, text)
+RETURNS text
+AS 'MODULE_PATHNAME', 'ora_decode'
+LANGUAGE C IMMUTABLE;
+
+CREATE FUNCTION decode(anyelement, anyelement, text, anyelement, text, anyelement, text, anyelement, text, anyelement, text, anyelement, text, text)
+RETURNS text
+AS 'MODULE_PATHNAME', 'ora_decode'
+LANGUAGE C IMMUTABLE;
+
+CREATE FUNCTION decode(anyelement, anyelement, text, anyelement, text, anyelement, text, anyelement, text, anyelement, text, anyelement, text, anyelement, text)
+RETURNS text
+AS 'MODULE_PATHNAME', 'ora_decode'
+LANGUAGE C IMMUTABLE;
+
+CREATE FUNCTION decode(anyelement, anyelement, text, anyelement, text, anyelement, text, anyelement, text, anyelement, text, anyelement, text, anyelement, text, text)
+RETURNS text
+AS 'MODULE_PATHNAME', 'ora_decode'
+LANGUAGE C IMMUTABLE;
+
+CREATE FUNCTION decode(anyelement, anyelement, text, anyelement, text, anyelement, text, anyelement, text, anyelement, text, anyelement, text, anyelement, text, anyelement, text)
+RETURNS text
+AS 'MODULE_PATHNAME', 'ora_decode'
+LANGUAGE C IMMUTABLE;
+
+CREATE FUNCTION decode(anyelement, anyelement, text, anyelement, text, anyelement, text, anyelement, text, anyelement, text, anyelement, text, anyelement, text, anyelement, text, text)
+RETURNS text
+AS 'MODULE_PATHNAME', 'ora_decode'
+LANGUAGE C IMMUTABLE;
+
+CREATE FUNCTION decode(anyelement, anyelement, text, anyelement, text, anyelement, text, anyelement, text, anyelement, text, anyelement, text, anyelement, text, anyelement, text, anyelement, text)
+RETURNS text
+AS 'MODULE_PATHNAME', 'ora_decode'
+LANGUAGE C IMMUTABLE;
+
+CREATE FUNCTION decode(anyelement, anyelement, text, anyelement, text, anyelement, text, anyelement, text, anyelement, text, anyelement, text, anyelement, text, anyelement, text, anyelement, text, text)
+RETURNS text
+AS 'MODULE_PATHNAME', 'ora_decode'
+LANGUAGE C IMMUTABLE;
+
+CREATE FUNCTION decode(anyelement, anyelement, text, anyelement, text, anyelement, text, anyelement, text, anyelement, text, anyelement, text, anyelement, text, anyelement, text, anyelement, text, anyelement, text)
+RETURNS text
+AS 'MODULE_PATHNAME', 'ora_decode'
+LANGUAGE C IMMUTABLE;
+
+CREATE FUNCTION decode(anyelement, anyelement, text, anyelement, text, anyelement, text, anyelement, text, anyelement, text, anyelement, text, anyelement, text, anyelement, text, anyelement, text, anyelement, text, text)
+RETURNS text
+AS 'MODULE_PATHNAME', 'ora_decode'
+LANGUAGE C IMMUTABLE;
+
 CREATE FUNCTION decode(anyelement, anyelement, bpchar)
 RETURNS bpchar
 AS 'MODULE_PATHNAME', 'ora_decode'
@@ -1166,6 +1251,99 @@ AS 'MODULE_PATHNAME','plvdate_isleapyear'
 LANGUAGE C VOLATILE STRICT;
 COMMENT ON FUNCTION plvdate.isleapyear(date) IS 'Is leap year';
 
+/* named business calendars */
+CREATE TABLE plvdate.calendar(
+  name text PRIMARY KEY,
+  nonbizdays text[] NOT NULL DEFAULT '{Saturday,Sunday}',
+  use_easter bool NOT NULL DEFAULT true,
+  use_great_friday bool NOT NULL DEFAULT true
+);
+
+CREATE TABLE plvdate.calendar_holiday(
+  calendar text REFERENCES plvdate.calendar(name) ON UPDATE CASCADE ON DELETE CASCADE,
+  month int CHECK (month BETWEEN 1 AND 12),
+  day int CHECK (day BETWEEN 1 AND 31),
+  PRIMARY KEY(calendar, month, day)
+);
+
+CREATE TABLE plvdate.calendar_feast(
+  calendar text REFERENCES plvdate.calendar(name) ON UPDATE CASCADE ON DELETE CASCADE,
+  easter_offset int CHECK (easter_offset BETWEEN -80 AND 80),
+  PRIMARY KEY(calendar, easter_offset)
+);
+
+CREATE TABLE plvdate.calendar_exception(
+  calendar text REFERENCES plvdate.calendar(name) ON UPDATE CASCADE ON DELETE CASCADE,
+  day date,
+  PRIMARY KEY(calendar, day)
+);
+
+SELECT pg_catalog.pg_extension_config_dump('plvdate.calendar', '');
+SELECT pg_catalog.pg_extension_config_dump('plvdate.calendar_holiday', '');
+SELECT pg_catalog.pg_extension_config_dump('plvdate.calendar_feast', '');
+SELECT pg_catalog.pg_extension_config_dump('plvdate.calendar_exception', '');
+
+GRANT SELECT ON plvdate.calendar, plvdate.calendar_holiday,
+  plvdate.calendar_feast, plvdate.calendar_exception TO PUBLIC;
+
+CREATE FUNCTION plvdate.calendar_changed()
+RETURNS trigger
+AS 'MODULE_PATHNAME','plvdate_calendar_changed'
+LANGUAGE C;
+COMMENT ON FUNCTION plvdate.calendar_changed() IS 'Invalidate cached named calendars';
+
+CREATE TRIGGER calendar_changed
+AFTER INSERT OR UPDATE OR DELETE OR TRUNCATE ON plvdate.calendar
+FOR EACH STATEMENT EXECUTE PROCEDURE plvdate.calendar_changed();
+
+CREATE TRIGGER calendar_changed
+AFTER INSERT OR UPDATE OR DELETE OR TRUNCATE ON plvdate.calendar_holiday
+FOR EACH STATEMENT EXECUTE PROCEDURE plvdate.calendar_changed();
+
+CREATE TRIGGER calendar_changed
+AFTER INSERT OR UPDATE OR DELETE OR TRUNCATE ON plvdate.calendar_feast
+FOR EACH STATEMENT EXECUTE PROCEDURE plvdate.calendar_changed();
+
+CREATE TRIGGER calendar_changed
+AFTER INSERT OR UPDATE OR DELETE OR TRUNCATE ON plvdate.calendar_exception
+FOR EACH STATEMENT EXECUTE PROCEDURE plvdate.calendar_changed();
+
+CREATE FUNCTION plvdate.add_bizdays(date, int, calendar text)
+RETURNS date
+AS 'MODULE_PATHNAME','plvdate_add_bizdays'
+LANGUAGE C STABLE STRICT;
+COMMENT ON FUNCTION plvdate.add_bizdays(date, int, text) IS 'Get the date created by adding <n> business days to a date, named calendar';
+
+CREATE FUNCTION plvdate.nearest_bizday(date, calendar text)
+RETURNS date
+AS 'MODULE_PATHNAME','plvdate_nearest_bizday'
+LANGUAGE C STABLE STRICT;
+COMMENT ON FUNCTION plvdate.nearest_bizday(date, text) IS 'Get the nearest business date to a given date, named calendar';
+
+CREATE FUNCTION plvdate.next_bizday(date, calendar text)
+RETURNS date
+AS 'MODULE_PATHNAME','plvdate_next_bizday'
+LANGUAGE C STABLE STRICT;
+COMMENT ON FUNCTION plvdate.next_bizday(date, text) IS 'Get the next business date from a given date, named calendar';
+
+CREATE FUNCTION plvdate.bizdays_between(date, date, calendar text)
+RETURNS int
+AS 'MODULE_PATHNAME','plvdate_bizdays_between'
+LANGUAGE C STABLE STRICT;
+COMMENT ON FUNCTION plvdate.bizdays_between(date, date, text) IS 'Get the number of business days between two dates, named calendar';
+
+CREATE FUNCTION plvdate.prev_bizday(date, calendar text)
+RETURNS date
+AS 'MODULE_PATHNAME','plvdate_prev_bizday'
+LANGUAGE C STABLE STRICT;
+COMMENT ON FUNCTION plvdate.prev_bizday(date, text) IS 'Get the previous business date from a given date, named calendar';
+
+CREATE FUNCTION plvdate.isbizday(date, calendar text)
+RETURNS bool
+AS 'MODULE_PATHNAME','plvdate_isbizday'
+LANGUAGE C STABLE STRICT;
+COMMENT ON FUNCTION plvdate.isbizday(date, text) IS 'Call this function to determine if a date is a business day, named calendar';
+
 
 -- PLVstr package
 
@@ -1596,6 +1774,18 @@ AS 'MODULE_PATHNAME','dbms_utility_format_call_stack0'
 LANGUAGE C VOLATILE;
 COMMENT ON FUNCTION dbms_utility.format_call_stack() IS 'Return formated call stack';
 
+CREATE FUNCTION dbms_utility.call_stack_depth()
+RETURNS int
+AS 'MODULE_PATHNAME','dbms_utility_call_stack_depth'
+LANGUAGE C VOLATILE;
+COMMENT ON FUNCTION dbms_utility.call_stack_depth() IS 'Returns number of PL/pgSQL functions on call stack';
+
+CREATE FUNCTION dbms_utility.call_stack(OUT depth int, OUT func oid, OUT lineno int)
+RETURNS SETOF RECORD
+AS 'MODULE_PATHNAME','dbms_utility_call_stack'
+LANGUAGE C VOLATILE;
+COMMENT ON FUNCTION dbms_utility.call_stack() IS 'Returns PL/pgSQL functions on call stack';
+
 CREATE SCHEMA plvlex;
 
 CREATE FUNCTION plvlex.tokens(IN str text, IN skip_spaces bool, IN qualified_names bool,
@@ -1605,6 +1795,17 @@ AS 'MODULE_PATHNAME','plvlex_tokens'
 LANGUAGE C IMMUTABLE STRICT;
 COMMENT ON FUNCTION plvlex.tokens(text,bool,bool) IS 'Parse SQL string';
 
+CREATE FUNCTION plvlex.fingerprint(str text)
+RETURNS bigint
+AS 'MODULE_PATHNAME','plvlex_fingerprint'
+LANGUAGE C IMMUTABLE STRICT;
+COMMENT ON FUNCTION plvlex.fingerprint(text) IS 'Returns hash of normalized SQL string';
+
+CREATE FUNCTION plvlex.fingerprint(str text, with_text bool, OUT hash bigint, OUT normalized text)
+AS 'MODULE_PATHNAME','plvlex_fingerprint'
+LANGUAGE C IMMUTABLE STRICT;
+COMMENT ON FUNCTION plvlex.fingerprint(text,bool) IS 'Returns hash and optionally normalized SQL string';
+
 CREATE SCHEMA utl_file;
 CREATE DOMAIN utl_file.file_type integer;
 
@@ -2018,6 +2219,11 @@ RETURNS varchar
 AS 'MODULE_PATHNAME', 'orafce_dump'
 LANGUAGE C;
 
+CREATE FUNCTION dump(text, integer, integer, integer)
+RETURNS varchar
+AS 'MODULE_PATHNAME', 'orafce_dump'
+LANGUAGE C;
+
 CREATE FUNCTION utl_file.put_line(file utl_file.file_type, buffer anyelement)
 RETURNS bool
 AS $$SELECT utl_file.put_line($1, $2::text); $$
@@ -12,6 +12,15 @@
 char  *nls_date_format = NULL;
 char  *orafce_timezone = NULL;
 
+/* orafce.timezone resolved by check_timezone */
+pg_tz *orafce_tz = NULL;
+
+static void
+assign_orafce_timezone(const char *newval, void *extra)
+{
+	orafce_tz = *((pg_tz **) extra);
+}
+
 void
 _PG_init(void)
 {
@@ -32,8 +41,8 @@ _PG_init(void)
 									NULL,
 									PGC_USERSET,
 									0,
-									NULL,
-									NULL, NULL);
+									check_nls_date_format,
+									assign_nls_date_format, NULL);
 
 	DefineCustomStringVariable("orafce.timezone",
 									"Specify timezone used for sysdate function.",
@@ -42,7 +51,17 @@ _PG_init(void)
 									"GMT",
 									PGC_USERSET,
 									0,
-									check_timezone, NULL, show_timezone);
+									check_timezone, assign_orafce_timezone, show_timezone);
+
+	DefineCustomBoolVariable("orafce.plpgsql_call_stack",
+									"Read PL/pgSQL call stack by empty PL/pgSQL plugin.",
+									"When it is on, orafce occupies PLpgSQL_plugin slot, if it is free.",
+									&orafce_plpgsql_call_stack,
+									false,
+									PGC_USERSET,
+									0,
+									NULL,
+									assign_plpgsql_call_stack, NULL);
 
 	EmitWarningsOnPlaceholders("orafce");
 }
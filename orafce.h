@@ -7,6 +7,7 @@
 #include <sys/time.h>
 #include "utils/datetime.h"
 #include "utils/datum.h"
+#include "utils/guc.h"
 
 #define TextPCopy(t) \
 	DatumGetTextP(datumCopy(PointerGetDatum(t), false, -1))
@@ -26,9 +27,8 @@ typedef union vardata
 	void   *p;
 } vardata;
 
-extern int ora_instr(text *txt, text *pattern, int start, int nth);
-extern int ora_mb_strlen(text *str, char **sizes, int **positions);
 extern int ora_mb_strlen1(text *str);
+extern int ora_mbstrlen_with_len(const char *str, int len);
 
 extern char *nls_date_format;
 extern char *orafce_timezone;
@@ -36,6 +36,15 @@ extern char *orafce_timezone;
 extern char *nls_date_format;
 extern char *orafce_timezone;
 
+extern pg_tz *orafce_tz;
+
+extern bool check_nls_date_format(char **newval, void **extra, GucSource source);
+extern void assign_nls_date_format(const char *newval, void *extra);
+
+extern bool orafce_plpgsql_call_stack;
+
+extern void assign_plpgsql_call_stack(bool newval, void *extra);
+
 /*
  * Version compatibility
  */
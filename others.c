@@ -1,6 +1,7 @@
 #include "postgres.h"
 #include <stdlib.h>
 #include <locale.h>
+#include "access/tuptoaster.h"
 #include "catalog/pg_operator.h"
 #include "catalog/pg_type.h"
 #include "fmgr.h"
@@ -14,7 +15,15 @@
 #include "utils/datum.h"
 #include "utils/lsyscache.h"
 #include "utils/memutils.h"
+#include "utils/pg_locale.h"
 #include "utils/syscache.h"
+#include "mb/pg_wchar.h"
+
+#ifdef USE_ICU
+#include <unicode/ucol.h>
+#include <unicode/ustring.h>
+#endif
+
 #include "orafce.h"
 #include "builtins.h"
 
@@ -125,6 +134,218 @@ ora_set_nls_sort(PG_FUNCTION_ARGS)
 	PG_RETURN_VOID();
 }
 
+/*
+ * Locales used by nlssort are created by newlocale once per backend, and
+ * strings are transformed by strxfrm_l, so we don't need to switch process
+ * locale by setlocale for every row. Locale names with "-x-icu" suffix
+ * (same convention as PostgreSQL ICU collations) use ICU collator, when
+ * PostgreSQL is built with ICU support.
+ */
+#if defined(HAVE_LOCALE_T) && !defined(WIN32)
+#define NLSSORT_USE_LOCALE_T
+#ifdef USE_ICU
+#define NLSSORT_USE_ICU
+#endif
+#endif
+
+#define ICU_LOCALE_SUFFIX		"-x-icu"
+
+typedef struct NlsSortLocale
+{
+	struct NlsSortLocale *next;
+	char	   *name;
+#ifdef NLSSORT_USE_LOCALE_T
+	locale_t	loc;
+#endif
+#ifdef NLSSORT_USE_ICU
+	UCollator  *collator;
+#endif
+} NlsSortLocale;
+
+#ifdef NLSSORT_USE_LOCALE_T
+
+static NlsSortLocale *nlssort_locales = NULL;
+
+#define NLS_STRXFRM(dest, src, n, l) \
+	((l) != NULL ? strxfrm_l((dest), (src), (n), (l)->loc) : strxfrm((dest), (src), (n)))
+
+static NlsSortLocale *
+get_nlssort_locale(const char *name)
+{
+	NlsSortLocale *l;
+	locale_t	loc = (locale_t) 0;
+#ifdef NLSSORT_USE_ICU
+	UCollator  *collator = NULL;
+	int			name_len = strlen(name);
+	int			suffix_len = strlen(ICU_LOCALE_SUFFIX);
+#endif
+
+	for (l = nlssort_locales; l != NULL; l = l->next)
+	{
+		if (strcmp(l->name, name) == 0)
+			return l;
+	}
+
+#ifdef NLSSORT_USE_ICU
+	if (name_len > suffix_len &&
+		strcmp(name + name_len - suffix_len, ICU_LOCALE_SUFFIX) == 0)
+	{
+		UErrorCode	status = U_ZERO_ERROR;
+		char	   *icu_name = pnstrdup(name, name_len - suffix_len);
+
+		collator = ucol_open(icu_name, &status);
+		if (U_FAILURE(status))
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					 errmsg("could not open collator for locale \"%s\": %s",
+							icu_name, u_errorName(status))));
+
+		/*
+		 * An unknown locale is reported only by warning status, and then
+		 * the root collator is used. A fallback to a parent locale (en-US
+		 * to en) is fine, but a fallback to root is not, when the root
+		 * locale was not requested.
+		 */
+		if (status == U_USING_DEFAULT_WARNING || status == U_USING_FALLBACK_WARNING)
+		{
+			UErrorCode	lstatus = U_ZERO_ERROR;
+			const char *actual;
+
+			actual = ucol_getLocaleByType(collator, ULOC_ACTUAL_LOCALE, &lstatus);
+
+			if (U_FAILURE(lstatus) || actual == NULL ||
+				*actual == '\0' || strcmp(actual, "root") == 0)
+			{
+				if (!(*icu_name == '\0' ||
+					  pg_strcasecmp(icu_name, "root") == 0 ||
+					  pg_strncasecmp(icu_name, "und", 3) == 0))
+				{
+					ucol_close(collator);
+					ereport(ERROR,
+							(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+							 errmsg("could not open collator for locale \"%s\": %s",
+									icu_name, u_errorName(status))));
+				}
+			}
+		}
+		pfree(icu_name);
+	}
+	else
+#endif
+	{
+		loc = newlocale(LC_COLLATE_MASK, name, (locale_t) 0);
+		if (loc == (locale_t) 0)
+			elog(ERROR, "failed to set the requested LC_COLLATE value [%s]", name);
+	}
+
+	l = MemoryContextAllocZero(TopMemoryContext, sizeof(NlsSortLocale));
+	l->name = MemoryContextStrdup(TopMemoryContext, name);
+	l->loc = loc;
+#ifdef NLSSORT_USE_ICU
+	l->collator = collator;
+#endif
+
+	l->next = nlssort_locales;
+	nlssort_locales = l;
+
+	return l;
+}
+
+#else
+
+#define NLS_STRXFRM(dest, src, n, l)	strxfrm((dest), (src), (n))
+
+#endif
+
+/*
+ * Text transformation.
+ * Increase the buffer until the strxfrm is able to fit.
+ */
+static text *
+_nls_transform(const char *string_str, int string_len, NlsSortLocale *l)
+{
+	text *result;
+	char *tmp = NULL;
+	size_t size = 0;
+	size_t rest = 0;
+
+	size = string_len * multiplication + 1;
+	tmp = palloc(size + VARHDRSZ);
+
+	rest = NLS_STRXFRM(tmp + VARHDRSZ, string_str, size, l);
+	while (rest >= size)
+	{
+		pfree(tmp);
+		size = rest + 1;
+		tmp = palloc(size + VARHDRSZ);
+		rest = NLS_STRXFRM(tmp + VARHDRSZ, string_str, size, l);
+		/*
+		 * Cache the multiplication factor so that the next
+		 * time we start with better value.
+		 */
+		if (string_len)
+			multiplication = (rest / string_len) + 2;
+	}
+
+	/*
+	 * If the multiplication factor went down, reset it.
+	 */
+	if (string_len && rest < string_len * multiplication / 4)
+		multiplication = (rest / string_len) + 1;
+
+	result = (text *) tmp;
+	SET_VARSIZE(result, rest + VARHDRSZ);
+	return result;
+}
+
+#ifdef NLSSORT_USE_ICU
+
+static text *
+_nls_run_ucol(UCollator *collator, char *string_str, int string_len)
+{
+	UErrorCode	status = U_ZERO_ERROR;
+	UChar	   *ustr;
+	int32_t		ulen;
+	int32_t		size;
+	int32_t		keylen;
+	text	   *result;
+
+	if (GetDatabaseEncoding() != PG_UTF8)
+	{
+		string_str = (char *) pg_do_encoding_conversion((unsigned char *) string_str,
+														string_len,
+														GetDatabaseEncoding(),
+														PG_UTF8);
+		string_len = strlen(string_str);
+	}
+
+	ustr = palloc((string_len + 1) * sizeof(UChar));
+	u_strFromUTF8(ustr, string_len + 1, &ulen, string_str, string_len, &status);
+	if (U_FAILURE(status))
+		ereport(ERROR,
+				(errmsg("could not convert string to UTF-16: %s",
+						u_errorName(status))));
+
+	size = string_len * multiplication + 1;
+	result = palloc(size + VARHDRSZ);
+	keylen = ucol_getSortKey(collator, ustr, ulen, (uint8_t *) VARDATA(result), size);
+	if (keylen > size)
+	{
+		pfree(result);
+		size = keylen;
+		result = palloc(size + VARHDRSZ);
+		keylen = ucol_getSortKey(collator, ustr, ulen, (uint8_t *) VARDATA(result), size);
+	}
+
+	pfree(ustr);
+
+	/* the sort key is terminated by zero byte, that is not stored */
+	SET_VARSIZE(result, (keylen > 0 ? keylen - 1 : 0) + VARHDRSZ);
+	return result;
+}
+
+#endif
+
 static text*
 _nls_run_strxfrm(text *string, text *locale)
 {
@@ -135,10 +356,9 @@ _nls_run_strxfrm(text *string, text *locale)
 	int locale_len = 0;
 
 	text *result;
-	char *tmp = NULL;
-	size_t size = 0;
-	size_t rest = 0;
+#ifndef NLSSORT_USE_LOCALE_T
 	int changed_locale = 0;
+#endif
 
 	/*
 	 * Save the default, server-wide locale setting.
@@ -175,7 +395,7 @@ _nls_run_strxfrm(text *string, text *locale)
 	}
 
 	/*
-	 * If different than default locale is requested, call setlocale.
+	 * If different than default locale is requested, use it.
 	 */
 	if (locale_len > 0
 		&& (strncmp(lc_collate_cache, VARDATA_ANY(locale), locale_len)
@@ -184,7 +404,30 @@ _nls_run_strxfrm(text *string, text *locale)
 		locale_str = palloc(locale_len + 1);
 		memcpy(locale_str, VARDATA_ANY(locale), locale_len);
 		*(locale_str + locale_len) = '\0';
+	}
+
+#ifdef NLSSORT_USE_LOCALE_T
+
+	if (locale_str)
+	{
+		NlsSortLocale *l = get_nlssort_locale(locale_str);
+
+#ifdef NLSSORT_USE_ICU
+		if (l->collator)
+			result = _nls_run_ucol(l->collator, string_str, string_len);
+		else
+#endif
+			result = _nls_transform(string_str, string_len, l);
+
+		pfree(locale_str);
+	}
+	else
+		result = _nls_transform(string_str, string_len, NULL);
 
+#else
+
+	if (locale_str)
+	{
 		/*
 		 * Try to set correct locales.
 		 * If setlocale failed, we know the default stayed the same,
@@ -204,28 +447,7 @@ _nls_run_strxfrm(text *string, text *locale)
 	 */
 	PG_TRY();
 	{
-
-		/*
-		 * Text transformation.
-		 * Increase the buffer until the strxfrm is able to fit.
-		 */
-		size = string_len * multiplication + 1;
-		tmp = palloc(size + VARHDRSZ);
-
-		rest = strxfrm(tmp + VARHDRSZ, string_str, size);
-		while (rest >= size)
-		{
-			pfree(tmp);
-			size = rest + 1;
-			tmp = palloc(size + VARHDRSZ);
-			rest = strxfrm(tmp + VARHDRSZ, string_str, size);
-			/*
-			 * Cache the multiplication factor so that the next
-			 * time we start with better value.
-			 */
-			if (string_len)
-				multiplication = (rest / string_len) + 2;
-		}
+		result = _nls_transform(string_str, string_len, NULL);
 	}
 	PG_CATCH ();
 	{
@@ -236,6 +458,7 @@ _nls_run_strxfrm(text *string, text *locale)
 			if (!setlocale(LC_COLLATE, lc_collate_cache))
 				elog(FATAL, "failed to set back the default LC_COLLATE value [%s]", lc_collate_cache);
 		}
+		PG_RE_THROW();
 	}
 	PG_END_TRY ();
 
@@ -248,16 +471,11 @@ _nls_run_strxfrm(text *string, text *locale)
 			elog(FATAL, "failed to set back the default LC_COLLATE value [%s]", lc_collate_cache);
 		pfree(locale_str);
 	}
-	pfree(string_str);
 
-	/*
-	 * If the multiplication factor went down, reset it.
-	 */
-	if (string_len && rest < string_len * multiplication / 4)
-		multiplication = (rest / string_len) + 1;
+#endif
+
+	pfree(string_str);
 
-	result = (text *) tmp;
-	SET_VARSIZE(result, rest + VARHDRSZ);
 	return result;
 }
 
@@ -296,6 +514,135 @@ ora_nlssort(PG_FUNCTION_ARGS)
 
 PG_FUNCTION_INFO_V1(ora_decode);
 
+/*
+ * When decode has many search arguments and all of them are constants,
+ * the search arguments are hashed once and every row is processed by
+ * one hash lookup instead of linear scan. Parameters are not accepted,
+ * their values can be changed between calls with same fn_extra.
+ */
+#define DECODE_HASH_MIN_SEARCHES		8
+
+typedef struct
+{
+	uint32		hash;
+	int			argno;			/* 0 is used for empty slot */
+} DecodeHashEntry;
+
+typedef struct
+{
+	FmgrInfo	eq;
+	FmgrInfo	hash;
+	bool		use_hash;
+	uint32		mask;
+	DecodeHashEntry *entries;
+} DecodeCache;
+
+static bool
+decode_equal(FmgrInfo *eq, Oid collation, Datum arg1, Datum arg2)
+{
+	FunctionCallInfoData	func;
+	Datum					result;
+
+	InitFunctionCallInfoData(func, eq, 2, collation, NULL, NULL);
+
+	func.arg[0] = arg1;
+	func.arg[1] = arg2;
+	func.argnull[0] = false;
+	func.argnull[1] = false;
+	result = FunctionCallInvoke(&func);
+
+	return !func.isnull && DatumGetBool(result);
+}
+
+/*
+ * Prepare the equality function, and when it is possible, the hash table
+ * of search arguments. Only first occurrence of some value is stored,
+ * so the lookup returns same argument like linear search.
+ */
+static DecodeCache *
+decode_init_cache(FunctionCallInfo fcinfo, int nargs, Oid collation)
+{
+	MemoryContext	oldctx;
+	DecodeCache	   *cache;
+	Oid				typid = get_fn_expr_argtype(fcinfo->flinfo, 0);
+	Oid				eqop;
+	RegProcedure	hash_proc;
+	int				nsearches = 0;
+	int				i;
+
+	get_sort_group_operators(typid, false, true, false, NULL, &eqop, NULL, NULL);
+
+	oldctx = MemoryContextSwitchTo(fcinfo->flinfo->fn_mcxt);
+
+	cache = palloc0(sizeof(DecodeCache));
+	fmgr_info(get_opcode(eqop), &cache->eq);
+
+	if (fcinfo->flinfo->fn_expr && IsA(fcinfo->flinfo->fn_expr, FuncExpr))
+	{
+		List	   *args = ((FuncExpr *) fcinfo->flinfo->fn_expr)->args;
+
+		for (i = 1; i < nargs; i += 2)
+		{
+			if (!IsA(list_nth(args, i), Const))
+				break;
+			if (!PG_ARGISNULL(i))
+				nsearches += 1;
+		}
+	}
+	else
+		i = 1;
+
+	if (i >= nargs && nsearches >= DECODE_HASH_MIN_SEARCHES &&
+		op_hashjoinable(eqop, typid) &&
+		get_op_hash_functions(eqop, &hash_proc, NULL))
+	{
+		uint32		size = 1;
+
+		while (size < (uint32) nsearches * 2)
+			size <<= 1;
+
+		fmgr_info(hash_proc, &cache->hash);
+		cache->mask = size - 1;
+		cache->entries = palloc0(size * sizeof(DecodeHashEntry));
+		cache->use_hash = true;
+
+		for (i = 1; i < nargs; i += 2)
+		{
+			Datum		value;
+			uint32		h;
+			uint32		slot;
+			DecodeHashEntry *e;
+
+			if (PG_ARGISNULL(i))
+				continue;
+
+			value = PG_GETARG_DATUM(i);
+			h = DatumGetUInt32(FunctionCall1Coll(&cache->hash, collation, value));
+			slot = h & cache->mask;
+
+			while ((e = &cache->entries[slot])->argno != 0)
+			{
+				if (e->hash == h &&
+					decode_equal(&cache->eq, collation, value,
+								 PG_GETARG_DATUM(e->argno)))
+					break;
+				slot = (slot + 1) & cache->mask;
+			}
+
+			/* don't overwrite an earlier equal search argument */
+			if (e->argno == 0)
+			{
+				e->hash = h;
+				e->argno = i;
+			}
+		}
+	}
+
+	MemoryContextSwitchTo(oldctx);
+
+	return cache;
+}
+
 /*
  * decode(lhs, [rhs, ret], ..., [default])
  */
@@ -329,49 +676,53 @@ ora_decode(PG_FUNCTION_ARGS)
 	}
 	else
 	{
-		FmgrInfo   *eq;
+		DecodeCache *cache;
 		Oid		collation = PG_GET_COLLATION();
 
 		/*
-		 * On first call, get the input type's operator '=' and save at
-		 * fn_extra.
+		 * On first call, get the input type's operator '=' (and hash table
+		 * of search arguments) and save at fn_extra.
 		 */
 		if (fcinfo->flinfo->fn_extra == NULL)
+			fcinfo->flinfo->fn_extra = decode_init_cache(fcinfo, nargs, collation);
+
+		cache = (DecodeCache *) fcinfo->flinfo->fn_extra;
+
+		if (cache->use_hash)
 		{
-			MemoryContext	oldctx;
-			Oid				typid = get_fn_expr_argtype(fcinfo->flinfo, 0);
-			Oid				eqoid = equality_oper_funcid(typid);
+			Datum		value = PG_GETARG_DATUM(0);
+			uint32		h;
+			uint32		slot;
+			DecodeHashEntry *e;
 
-			oldctx = MemoryContextSwitchTo(fcinfo->flinfo->fn_mcxt);
-			eq = palloc(sizeof(FmgrInfo));
-			fmgr_info(eqoid, eq);
-			MemoryContextSwitchTo(oldctx);
+			h = DatumGetUInt32(FunctionCall1Coll(&cache->hash, collation, value));
+			slot = h & cache->mask;
 
-			fcinfo->flinfo->fn_extra = eq;
+			while ((e = &cache->entries[slot])->argno != 0)
+			{
+				if (e->hash == h &&
+					decode_equal(&cache->eq, collation, value,
+								 PG_GETARG_DATUM(e->argno)))
+				{
+					retarg = e->argno + 1;
+					break;
+				}
+				slot = (slot + 1) & cache->mask;
+			}
 		}
 		else
-			eq = fcinfo->flinfo->fn_extra;
-
-		for (i = 1; i < nargs; i += 2)
 		{
-			FunctionCallInfoData	func;
-			Datum					result;
-
-			if (PG_ARGISNULL(i))
-				continue;
-
-			InitFunctionCallInfoData(func, eq, 2, collation, NULL, NULL);
-
-			func.arg[0] = PG_GETARG_DATUM(0);
-			func.arg[1] = PG_GETARG_DATUM(i);
-			func.argnull[0] = false;
-			func.argnull[1] = false;
-			result = FunctionCallInvoke(&func);
-
-			if (!func.isnull && DatumGetBool(result))
+			for (i = 1; i < nargs; i += 2)
 			{
-				retarg = i + 1;
-				break;
+				if (PG_ARGISNULL(i))
+					continue;
+
+				if (decode_equal(&cache->eq, collation,
+								 PG_GETARG_DATUM(0), PG_GETARG_DATUM(i)))
+				{
+					retarg = i + 1;
+					break;
+				}
 			}
 		}
 	}
@@ -391,13 +742,21 @@ equality_oper_funcid(Oid argtype)
 }
 
 /*
- * dump(anyexpr [,format])
+ * dump(anyexpr [,format [,start, length]])
  *
  *  the dump function returns a varchar2 value that includes the datatype code, 
  *  the length in bytes, and the internal representation of the expression.
+ *  When start and length are specified, only this part of representation
+ *  is displayed. For varlena types the length and positions are counted
+ *  in detoasted data of value (without varlena header), and only the
+ *  requested slice is detoasted.
  */
 PG_FUNCTION_INFO_V1(orafce_dump);
 
+static const char dump_digits[] = "0123456789abcdef";
+
+#define DUMP_CHUNK_SIZE		8192
+
 static void
 appendDatum(StringInfo str, const void *ptr, size_t length, int format)
 {
@@ -406,43 +765,88 @@ appendDatum(StringInfo str, const void *ptr, size_t length, int format)
 	else
 	{
 		const unsigned char *s = (const unsigned char *) ptr;
-		const char *formatstr;
+		unsigned int	base;
+		unsigned int	width;
+		char	   *p;
 		size_t	i;
 
 		switch (format)
 		{
 			case 8:
-				formatstr = "%ho";
-				break;
 			case 10: 
-				formatstr = "%hu";
-				break;
 			case 16:
-				formatstr = "%hx";
+				base = format;
 				break;
 			case 17:
-				formatstr = "%hc";
+				base = 0;
 				break;
 			default:
 				elog(ERROR, "unknown format");
-				formatstr  = NULL; 	/* quite compiler */
+				base = 0; 	/* quite compiler */
 		}
 
+		/* bytes needed for one byte of value, digits and separator */
+		width = base == 0 ? 2 : (base == 16 ? 3 : 4);
+
 		/* append a byte array with the specified format */
-		for (i = 0; i < length; i++)
+		i = 0;
+		while (i < length)
 		{
-			if (i > 0)
-				appendStringInfoChar(str, ',');
-
-			/* print only ANSI visible chars */
-			if (format == 17 && (iscntrl(s[i]) || !isascii(s[i])))
-				appendStringInfoChar(str, '?');
-			else
-				appendStringInfo(str, formatstr, s[i]);
+			size_t	chunk = Min(length - i, DUMP_CHUNK_SIZE);
+
+			/* the buffer grows with output, so only real size is limited */
+			enlargeStringInfo(str, (int) (chunk * width));
+			p = str->data + str->len;
+
+			for (; chunk > 0; chunk--, i++)
+			{
+				unsigned int	c = s[i];
+
+				if (i > 0)
+					*p++ = ',';
+
+				if (base == 0)
+				{
+					/* print only ANSI visible chars */
+					*p++ = (iscntrl(c) || !isascii(c)) ? '?' : (char) c;
+				}
+				else
+				{
+					if (c >= base * base)
+						*p++ = dump_digits[c / (base * base)];
+					if (c >= base)
+						*p++ = dump_digits[(c / base) % base];
+					*p++ = dump_digits[c % base];
+				}
+			}
+
+			*p = '\0';
+			str->len = p - str->data;
 		}
 	}
 }
 
+/*
+ * Returns offset and number of bytes specified by start position
+ * (negative start is counted from end) and length.
+ */
+static void
+dump_range(FunctionCallInfo fcinfo, Size total, Size *offset, Size *count)
+{
+	int		start = PG_GETARG_IF_EXISTS(2, INT32, 1);
+	int		len = PG_GETARG_IF_EXISTS(3, INT32, 0);
+
+	if (start > 0)
+		*offset = Min((Size) start - 1, total);
+	else if (start < 0)
+		*offset = (Size) -start < total ? total + start : 0;
+	else
+		*offset = 0;
+
+	*count = total - *offset;
+	if (len > 0 && (Size) len < *count)
+		*count = len;
+}
 
 Datum
 orafce_dump(PG_FUNCTION_ARGS)
@@ -452,9 +856,12 @@ orafce_dump(PG_FUNCTION_ARGS)
 	int16	typlen;
 	bool	typbyval;
 	Size	length;
+	Size	offset;
+	Size	count;
 	Datum	value;
 	int		format;
 	StringInfoData	str;
+	text   *result;
 
 	if (!fcinfo->flinfo || !fcinfo->flinfo->fn_expr)
 		elog(ERROR, "function is called from invalid context");
@@ -469,35 +876,72 @@ orafce_dump(PG_FUNCTION_ARGS)
 	valtype = exprType((Node *) list_nth(args, 0));
 
 	get_typlenbyval(valtype, &typlen, &typbyval);
-	length = datumGetSize(value, typbyval, typlen);
 
 	initStringInfo(&str);
-	appendStringInfo(&str, "Typ=%d Len=%d: ", valtype, (int) length);
 
-	if (!typbyval)
-	{
-		appendDatum(&str, DatumGetPointer(value), length, format);
-	}
-	else if (length <= 1)
-	{
-		char	v = DatumGetChar(value);
-		appendDatum(&str, &v, sizeof(char), format);
-	}
-	else if (length <= 2)
-	{
-		int16	v = DatumGetInt16(value);
-		appendDatum(&str, &v, sizeof(int16), format);
-	}
-	else if (length <= 4)
+	if (typlen == -1)
 	{
-		int32	v = DatumGetInt32(value);
-		appendDatum(&str, &v, sizeof(int32), format);
+		struct varlena *slice;
+
+		length = toast_raw_datum_size(value) - VARHDRSZ;
+		dump_range(fcinfo, length, &offset, &count);
+
+		slice = PG_DETOAST_DATUM_SLICE(value, offset, count);
+
+		appendStringInfo(&str, "Typ=%d Len=%d: ", valtype, (int) length);
+		appendDatum(&str, VARDATA_ANY(slice), VARSIZE_ANY_EXHDR(slice), format);
 	}
 	else
 	{
-		int64	v = DatumGetInt64(value);
-		appendDatum(&str, &v, sizeof(int64), format);
+		const char *ptr;
+		char	v1;
+		int16	v2;
+		int32	v4;
+		int64	v8;
+
+		length = datumGetSize(value, typbyval, typlen);
+
+		if (!typbyval)
+			ptr = DatumGetPointer(value);
+		else if (length <= 1)
+		{
+			v1 = DatumGetChar(value);
+			ptr = (const char *) &v1;
+			length = sizeof(char);
+		}
+		else if (length <= 2)
+		{
+			v2 = DatumGetInt16(value);
+			ptr = (const char *) &v2;
+			length = sizeof(int16);
+		}
+		else if (length <= 4)
+		{
+			v4 = DatumGetInt32(value);
+			ptr = (const char *) &v4;
+			length = sizeof(int32);
+		}
+		else
+		{
+			v8 = DatumGetInt64(value);
+			ptr = (const char *) &v8;
+			length = sizeof(int64);
+		}
+
+		if (PG_NARGS() > 2)
+			dump_range(fcinfo, length, &offset, &count);
+		else
+		{
+			offset = 0;
+			count = length;
+		}
+
+		appendStringInfo(&str, "Typ=%d Len=%d: ", valtype, (int) length);
+		appendDatum(&str, ptr + offset, count, format);
 	}
 
-	PG_RETURN_TEXT_P(cstring_to_text(str.data));
+	result = cstring_to_text_with_len(str.data, str.len);
+	pfree(str.data);
+
+	PG_RETURN_TEXT_P(result);
 }
@@ -2,9 +2,6 @@
   This code implements one part of functonality of
   free available library PL/Vision. Please look www.quest.com
 
-  This library isn't optimalized for big numbers, for working
-  with n days (n > 10000), can be slow (on my P4 31ms).
-
   Original author: Steven Feuerstein, 1996 - 2002
   PostgreSQL implementation author: Pavel Stehule, 2006-2016
 
@@ -14,7 +11,15 @@
 #define PLVDATE_VERSION  "PostgreSQL PLVdate, version 1.1, April 2016"
 
 #include "postgres.h"
+#include "catalog/pg_type.h"
+#include "commands/trigger.h"
+#include "executor/spi.h"
+#include "utils/array.h"
 #include "utils/date.h"
+#include "utils/datetime.h"
+#include "utils/inval.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
 #include "utils/builtins.h"
 #include "utils/nabstime.h"
 #include <sys/time.h>
@@ -48,6 +53,8 @@ PG_FUNCTION_INFO_V1(plvdate_version);
 PG_FUNCTION_INFO_V1(plvdate_days_inmonth);
 PG_FUNCTION_INFO_V1(plvdate_isleapyear);
 
+PG_FUNCTION_INFO_V1(plvdate_calendar_changed);
+
 
 #define CHECK_SEQ_SEARCH(_l, _s) \
 do { \
@@ -62,11 +69,7 @@ do { \
 #define SUNDAY     (1 << 0)
 #define SATURDAY   (1 << 6)
 
-static unsigned char nonbizdays = SUNDAY | SATURDAY;
-static bool use_easter = true;
-static bool use_great_friday = true;
 static bool include_start = true;
-static int country_id = -1;			/* unknown */
 
 #define MAX_holidays   30
 #define MAX_EXCEPTIONS 50
@@ -84,11 +87,46 @@ typedef struct {
 	int holidays_c;
 } cultural_info;
 
+#define YEAR_BITMAP_WORDS		6		/* 366 days */
+
+typedef struct {
+	uint64 bizdays[YEAR_BITMAP_WORDS];	/* bit n is set when n-th day of year is bizday */
+	DateADT first_day;
+	int bizdays_c;
+	int cum_bizdays;		/* count of bizdays in cached years before this year */
+} year_calendar;
+
+/*
+ * Calendar configuration - the session calendar is modified by
+ * set_nonbizday, use_easter, .. functions, named calendars are loaded
+ * from tables plvdate.calendar*.
+ */
+typedef struct BizCalendar {
+	char *name;						/* NULL for session calendar */
+	unsigned char nonbizdays;
+	bool use_easter;
+	bool use_great_friday;
+	int country_id;					/* -1 unknown */
+	holiday_desc *holidays;			/* sorted array */
+	int holidays_c;
+	DateADT *exceptions;			/* sorted array */
+	int exceptions_c;
+	int *feasts;					/* other movable feasts as days from easter sunday */
+	int feasts_c;
+	year_calendar *year_cache;
+	int year_cache_first;
+	int year_cache_c;
+	struct BizCalendar *next;
+} BizCalendar;
+
 static holiday_desc holidays[MAX_holidays];  /* sorted array */
 static DateADT exceptions[MAX_EXCEPTIONS];   /* sorted array */
 
-static int holidays_c = 0;
-static int exceptions_c = 0;
+static BizCalendar session_calendar = {
+	NULL, SUNDAY | SATURDAY, true, true, -1,
+	holidays, 0, exceptions, 0, NULL, 0,
+	NULL, 0, 0, NULL
+};
 
 static holiday_desc czech_holidays[] = {
 	{1,1}, // Novy rok
@@ -208,151 +246,825 @@ calc_easter_sunday(int year, int* dd, int* mm)
 }
 
 /*
- * returns true, when day d is any easter holiday.
- *
+ * Business days are counted in closed form. Business days of every year
+ * are stored in a bitmap (weekly nonbizdays, holidays, easter holidays and
+ * exceptions are applied when the bitmap is built). These bitmaps are cached
+ * for a continuous range of years together with prefix sums of their counts,
+ * so any interval needs only popcount of boundary years. The cache is reset
+ * when the calendar configuration is changed.
  */
-static bool
-easter_holidays(DateADT day, int y, int m)
+#define MAX_CACHED_YEARS		1000
+
+#define USES_EASTER(cal)	((cal)->use_easter || (cal)->use_great_friday || (cal)->feasts_c > 0)
+#define YEAR_CACHE_PADDING		8
+
+static inline int
+bitmap_popcount(uint64 word)
+{
+#if defined(__GNUC__)
+	return __builtin_popcountll(word);
+#else
+	word = word - ((word >> 1) & UINT64CONST(0x5555555555555555));
+	word = (word & UINT64CONST(0x3333333333333333)) + ((word >> 2) & UINT64CONST(0x3333333333333333));
+	word = (word + (word >> 4)) & UINT64CONST(0x0f0f0f0f0f0f0f0f);
+	return (int) ((word * UINT64CONST(0x0101010101010101)) >> 56);
+#endif
+}
+
+static inline int
+bitmap_lowest_bit(uint64 word)
+{
+#if defined(__GNUC__)
+	return __builtin_ctzll(word);
+#else
+	int result = 0;
+
+	while ((word & 1) == 0)
+	{
+		word >>= 1;
+		result += 1;
+	}
+	return result;
+#endif
+}
+
+static inline int
+bitmap_highest_bit(uint64 word)
+{
+#if defined(__GNUC__)
+	return 63 - __builtin_clzll(word);
+#else
+	int result = 63;
+
+	while ((word & (UINT64CONST(1) << 63)) == 0)
+	{
+		word <<= 1;
+		result -= 1;
+	}
+	return result;
+#endif
+}
+
+static void
+reset_year_cache(BizCalendar *cal)
+{
+	if (cal->year_cache != NULL)
+		pfree(cal->year_cache);
+
+	cal->year_cache = NULL;
+	cal->year_cache_c = 0;
+}
+
+static int
+date_year(DateADT day)
+{
+	int y, m, d;
+
+	j2date(day + POSTGRES_EPOCH_JDATE, &y, &m, &d);
+
+	return y;
+}
+
+static void
+clear_bizday(year_calendar *yc, DateADT day)
+{
+	int n = day - yc->first_day;
+
+	yc->bizdays[n / 64] &= ~(UINT64CONST(1) << (n % 64));
+}
+
+/*
+ * Build bitmap of bizdays of year y
+ */
+static void
+calc_year_calendar(BizCalendar *cal, int y, year_calendar *yc)
 {
-	if (use_great_friday || use_easter)
+	DateADT next = date2j(y + 1, 1, 1) - POSTGRES_EPOCH_JDATE;
+	int ndays;
+	int d;
+	int i;
+
+	yc->first_day = date2j(y, 1, 1) - POSTGRES_EPOCH_JDATE;
+	ndays = next - yc->first_day;
+
+	memset(yc->bizdays, 0, sizeof(yc->bizdays));
+
+	d = j2day(yc->first_day + POSTGRES_EPOCH_JDATE);
+	for (i = 0; i < ndays; i++)
+	{
+		if (((1 << d) & cal->nonbizdays) == 0)
+			yc->bizdays[i / 64] |= UINT64CONST(1) << (i % 64);
+		d = d < 6 ? d + 1 : 0;
+	}
+
+	for (i = 0; i < cal->holidays_c; i++)
+	{
+		int m = cal->holidays[i].month;
+		int md = cal->holidays[i].day;
+
+		/* 29th February is holiday only in leap year */
+		if (md <= date2j(y, m + 1, 1) - date2j(y, m, 1))
+			clear_bizday(yc, date2j(y, m, md) - POSTGRES_EPOCH_JDATE);
+	}
+
+	/*
+	 * Easter is defined only for years 1900 .. 2099, the usage of easter
+	 * out of this range is checked by check_easter_range.
+	 */
+	if (USES_EASTER(cal) && y >= 1900 && y <= 2099)
 	{
-		if (m == 3 || m == 4)
+		int easter_sunday_day;
+		int easter_sunday_month;
+		DateADT easter_sunday;
+
+		calc_easter_sunday(y, &easter_sunday_day, &easter_sunday_month);
+		easter_sunday = date2j(y, easter_sunday_month, easter_sunday_day) - POSTGRES_EPOCH_JDATE;
+
+		if (cal->use_easter)
 		{
-			int easter_sunday_day;
-			int easter_sunday_month;
-			int easter_sunday;
+			clear_bizday(yc, easter_sunday);
+			clear_bizday(yc, easter_sunday + 1);
+		}
 
-			calc_easter_sunday(y, &easter_sunday_day, &easter_sunday_month);
-			easter_sunday = date2j(y, easter_sunday_month, easter_sunday_day) - POSTGRES_EPOCH_JDATE;
+		/* Great Friday is introduced in Czech Republic in 2016 */
+		if (cal->use_great_friday && (cal->country_id != 0 || y >= 2016))
+			clear_bizday(yc, easter_sunday - 2);
 
-			if (use_easter && (day == easter_sunday || day == easter_sunday + 1))
-				return true;
+		for (i = 0; i < cal->feasts_c; i++)
+		{
+			DateADT feast = easter_sunday + cal->feasts[i];
 
-			if (use_great_friday && day == easter_sunday - 2)
-			{
-				/* Great Friday is introduced in Czech Republic in 2016 */
-				if (country_id == 0)
-				{
-					if (y >= 2016)
-						return true;
-				}
-				else
-					return true;
-			}
+			if (feast >= yc->first_day && feast < next)
+				clear_bizday(yc, feast);
 		}
 	}
 
-	return false;
+	for (i = 0; i < cal->exceptions_c; i++)
+		if (cal->exceptions[i] >= yc->first_day && cal->exceptions[i] < next)
+			clear_bizday(yc, cal->exceptions[i]);
+
+	yc->bizdays_c = 0;
+	for (i = 0; i < YEAR_BITMAP_WORDS; i++)
+		yc->bizdays_c += bitmap_popcount(yc->bizdays[i]);
 }
 
-static DateADT
-ora_add_bizdays(DateADT day, int days)
+/*
+ * Ensure years y1 .. y2 are in cache. Returns false, when the range is
+ * too wide for caching.
+ */
+static bool
+fill_year_cache(BizCalendar *cal, int y1, int y2)
 {
-	int d, dx;
-	int y, m, auxd;
-	holiday_desc hd;
+	year_calendar *cache;
+	int first = y1;
+	int last = y2;
+	int i;
 
-	d = j2day(day+POSTGRES_EPOCH_JDATE);
-	dx = days > 0? 1 : -1;
+	if (y2 - y1 >= MAX_CACHED_YEARS)
+		return false;
 
-	while (days != 0)
+	if (cal->year_cache_c > 0)
 	{
-		d = (d+dx) % 7;
-		d = (d < 0) ? 6:d;
-		day += dx;
-		if ((1 << d) & nonbizdays)
-			continue;
+		int cached_last = cal->year_cache_first + cal->year_cache_c - 1;
 
-		if (NULL != bsearch(&day, exceptions, exceptions_c,
-							sizeof(DateADT), dateadt_comp))
-			continue;
+		if (y1 >= cal->year_cache_first && y2 <= cached_last)
+			return true;
 
-		j2date(day + POSTGRES_EPOCH_JDATE, &y, &m, &auxd);
-		hd.day = (char) auxd;
-		hd.month = (char) m;
+		/* extend cached range with some reserve in direction of growth */
+		first = y1 < cal->year_cache_first ? y1 - YEAR_CACHE_PADDING : cal->year_cache_first;
+		last = y2 > cached_last ? y2 + YEAR_CACHE_PADDING : cached_last;
 
-		if (easter_holidays(day, y, m))
-			continue;
+		if (last - first >= MAX_CACHED_YEARS)
+		{
+			reset_year_cache(cal);
+			first = y1;
+			last = y2;
+		}
+	}
 
-		if (NULL != bsearch(&hd, holidays, holidays_c,
-							sizeof(holiday_desc), holiday_desc_comp))
+	cache = MemoryContextAlloc(TopMemoryContext, (last - first + 1) * sizeof(year_calendar));
+
+	for (i = 0; i <= last - first; i++)
+	{
+		int y = first + i;
+
+		if (cal->year_cache_c > 0 && y >= cal->year_cache_first && y < cal->year_cache_first + cal->year_cache_c)
+			cache[i] = cal->year_cache[y - cal->year_cache_first];
+		else
+			calc_year_calendar(cal, y, &cache[i]);
+
+		cache[i].cum_bizdays = i > 0 ? cache[i - 1].cum_bizdays + cache[i - 1].bizdays_c : 0;
+	}
+
+	reset_year_cache(cal);
+
+	cal->year_cache = cache;
+	cal->year_cache_first = first;
+	cal->year_cache_c = last - first + 1;
+
+	return true;
+}
+
+static year_calendar *
+get_year_calendar(BizCalendar *cal, int y)
+{
+	fill_year_cache(cal, y, y);
+
+	return &cal->year_cache[y - cal->year_cache_first];
+}
+
+/*
+ * Returns number of bizdays of year in interval day1 .. day2
+ */
+static int
+count_year_bizdays(year_calendar *yc, DateADT day1, DateADT day2)
+{
+	int from = Max(day1 - yc->first_day, 0);
+	int to = Min(day2 - yc->first_day, YEAR_BITMAP_WORDS * 64 - 1);
+	int result = 0;
+	int i;
+
+	if (from > to)
+		return 0;
+
+	for (i = from / 64; i <= to / 64; i++)
+	{
+		uint64 word = yc->bizdays[i];
+
+		if (i == from / 64)
+			word &= ~UINT64CONST(0) << (from % 64);
+		if (i == to / 64 && to % 64 != 63)
+			word &= (UINT64CONST(1) << (to % 64 + 1)) - 1;
+
+		result += bitmap_popcount(word);
+	}
+
+	return result;
+}
+
+/*
+ * Raise an error, when easter should be used for some year out of range,
+ * where easter is defined.
+ */
+static void
+check_easter_range(BizCalendar *cal, DateADT day1, DateADT day2)
+{
+	int dd, mm;
+	int y;
+	int y2;
+
+	if (!USES_EASTER(cal))
+		return;
+
+	y2 = date_year(day2);
+	for (y = date_year(day1); y <= y2; y++)
+	{
+		if (y >= 1900 && y <= 2099)
+		{
+			/* skip to the end of range of defined easter */
+			y = Min(2099, y2);
 			continue;
+		}
 
-		days -= dx;
+		/*
+		 * easter holidays can be only in March or April, other movable
+		 * feasts can be anywhere in the year.
+		 */
+		if (cal->feasts_c > 0 ||
+			(day1 < date2j(y, 5, 1) - POSTGRES_EPOCH_JDATE &&
+			 day2 >= date2j(y, 3, 1) - POSTGRES_EPOCH_JDATE))
+			calc_easter_sunday(y, &dd, &mm);
 	}
+}
+
+/*
+ * Returns number of bizdays in interval day1 .. day2
+ */
+static int
+count_bizdays(BizCalendar *cal, DateADT day1, DateADT day2)
+{
+	int y1 = date_year(day1);
+	int y2 = date_year(day2);
+	int result = 0;
+
+	check_easter_range(cal, day1, day2);
+
+	if (fill_year_cache(cal, y1, y2))
+	{
+		year_calendar *first = &cal->year_cache[y1 - cal->year_cache_first];
+		year_calendar *last = &cal->year_cache[y2 - cal->year_cache_first];
 
-	return day;
+		result = count_year_bizdays(first, day1, day2);
+		if (y1 < y2)
+			result += last->cum_bizdays - (first + 1)->cum_bizdays +
+					  count_year_bizdays(last, day1, day2);
+	}
+	else
+	{
+		year_calendar yc;
+		int y;
+
+		for (y = y1; y <= y2; y++)
+		{
+			calc_year_calendar(cal, y, &yc);
+			result += count_year_bizdays(&yc, day1, day2);
+		}
+	}
+
+	return result;
 }
 
+static int
+bizdays_in_week(BizCalendar *cal)
+{
+	int result = 0;
+	int d;
+
+	for (d = 0; d < 7; d++)
+		if (((1 << d) & cal->nonbizdays) == 0)
+			result += 1;
+
+	return result;
+}
 
+/*
+ * Returns number of weekly bizdays in interval day1 .. day2
+ */
 static int
-ora_diff_bizdays(DateADT day1, DateADT day2)
+count_weekly_bizdays(BizCalendar *cal, DateADT day1, DateADT day2)
 {
-	int d, days;
-	int y, m, auxd;
-	holiday_desc hd;
+	int ndays = day2 - day1 + 1;
+	int d = j2day(day1 + POSTGRES_EPOCH_JDATE);
+	int result;
+	int i;
 
-	int loops = 0;
-	bool start_is_bizday = false;
+	result = (ndays / 7) * bizdays_in_week(cal);
 
-	DateADT aux_day;
-	if (day1 > day2)
+	for (i = 0; i < ndays % 7; i++)
+		if (((1 << ((d + i) % 7)) & cal->nonbizdays) == 0)
+			result += 1;
+
+	return result;
+}
+
+/*
+ * Returns number of days off (that are weekly bizdays) in interval day1 .. day2
+ */
+static int
+count_offdays(BizCalendar *cal, DateADT day1, DateADT day2)
+{
+	return count_weekly_bizdays(cal, day1, day2) - count_bizdays(cal, day1, day2);
+}
+
+/*
+ * Returns n-th weekly bizday after (n > 0) or before (n < 0) day.
+ */
+static DateADT
+nth_weekly_bizday(BizCalendar *cal, DateADT day, int64 n)
+{
+	int dx = n > 0 ? 1 : -1;
+	int bizdays = bizdays_in_week(cal);
+	int64 result;
+	int d;
+
+	if (n < 0)
+		n = -n;
+
+	/* skip whole weeks (day of week is not changed), at least one bizday stays */
+	result = (int64) day + dx * ((n - 1) / bizdays) * 7;
+	n -= ((n - 1) / bizdays) * bizdays;
+
+	d = j2day(day + POSTGRES_EPOCH_JDATE);
+	while (n > 0)
 	{
-		aux_day = day1;
-		day1 = day2; day2 = aux_day;
+		result += dx;
+		d = (d + dx + 7) % 7;
+		if (((1 << d) & cal->nonbizdays) == 0)
+			n -= 1;
 	}
 
-	/* d is incremented on start of cycle, so now I have to decrease one */
-	d = j2day(day1+POSTGRES_EPOCH_JDATE-1);
-	days = 0;
+	if (result < -POSTGRES_EPOCH_JDATE ||
+		result >= date2j(JULIAN_MAXYEAR, 1, 1) - POSTGRES_EPOCH_JDATE)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATETIME_VALUE_OUT_OF_RANGE),
+				 errmsg("date out of range")));
 
-	while (day1 <= day2)
+	return (DateADT) result;
+}
+
+static bool
+is_bizday(BizCalendar *cal, DateADT day)
+{
+	year_calendar *yc;
+	int n;
+
+	/*
+	 * Weekly non-bizdays and exceptions are not bizdays without respect
+	 * to easter, so easter range is checked only for other days.
+	 */
+	if (((1 << j2day(day + POSTGRES_EPOCH_JDATE)) & cal->nonbizdays) != 0)
+		return false;
+
+	if (NULL != bsearch(&day, cal->exceptions, cal->exceptions_c,
+						sizeof(DateADT), dateadt_comp))
+		return false;
+
+	check_easter_range(cal, day, day);
+
+	yc = get_year_calendar(cal, date_year(day));
+	n = day - yc->first_day;
+
+	return (yc->bizdays[n / 64] & (UINT64CONST(1) << (n % 64))) != 0;
+}
+
+/*
+ * Returns the nearest bizday after (dx = 1) or before (dx = -1) day
+ * by searching in bitmaps.
+ */
+static DateADT
+step_bizday(BizCalendar *cal, DateADT day, int dx)
+{
+	DateADT from = day + dx;
+	DateADT result;
+
+	for (;;)
 	{
-		loops++;
-		day1 += 1;
-		d = (d+1) % 7;
+		year_calendar *yc;
+		int n;
+		int i;
+		uint64 word;
 
-		if ((1 << d) & nonbizdays)
-			continue;
+		if (from < -POSTGRES_EPOCH_JDATE ||
+			from >= date2j(JULIAN_MAXYEAR, 1, 1) - POSTGRES_EPOCH_JDATE)
+			ereport(ERROR,
+					(errcode(ERRCODE_DATETIME_VALUE_OUT_OF_RANGE),
+					 errmsg("date out of range")));
 
-		if (NULL != bsearch(&day1, exceptions, exceptions_c,
-							sizeof(DateADT), dateadt_comp))
-			continue;
+		yc = get_year_calendar(cal, date_year(from));
+		n = from - yc->first_day;
+		i = n / 64;
 
-		j2date(day1 + POSTGRES_EPOCH_JDATE, &y, &m, &auxd);
-		hd.day = (char) auxd;
-		hd.month = (char) m;
+		if (dx > 0)
+		{
+			word = yc->bizdays[i] & (~UINT64CONST(0) << (n % 64));
+			while (word == 0 && ++i < YEAR_BITMAP_WORDS)
+				word = yc->bizdays[i];
 
-		if (easter_holidays(day1, y, m))
-			continue;
+			if (word != 0)
+			{
+				result = yc->first_day + i * 64 + bitmap_lowest_bit(word);
+				break;
+			}
 
-		if (NULL != bsearch(&hd, holidays, holidays_c,
-							sizeof(holiday_desc), holiday_desc_comp))
-			continue;
+			from = date2j(date_year(from) + 1, 1, 1) - POSTGRES_EPOCH_JDATE;
+		}
+		else
+		{
+			word = yc->bizdays[i];
+			if (n % 64 != 63)
+				word &= (UINT64CONST(1) << (n % 64 + 1)) - 1;
+			while (word == 0 && --i >= 0)
+				word = yc->bizdays[i];
 
-		/* now the day have to be bizday, remember if first day was bizday */
-		if (loops == 1)
-			start_is_bizday = true;
+			if (word != 0)
+			{
+				result = yc->first_day + i * 64 + bitmap_highest_bit(word);
+				break;
+			}
 
-		days += 1;
+			from = yc->first_day - 1;
+		}
 	}
 
+	if (dx > 0)
+		check_easter_range(cal, day + 1, result);
+	else
+		check_easter_range(cal, result, day - 1);
+
+	return result;
+}
+
+/*
+ * Returns the days-th bizday after (or before for negative days) day.
+ * The searched date is the least fixed point of the equation: weekly bizdays
+ * in interval = days + days off in interval.
+ */
+static DateADT
+ora_add_bizdays(BizCalendar *cal, DateADT day, int days)
+{
+	DateADT result = day;
+	int64 need;
+	int offdays;
+
+	if (days == 0)
+		return day;
+
+	if (days == 1 || days == -1)
+		return step_bizday(cal, day, days);
+
+	need = days;
+	for (;;)
+	{
+		result = nth_weekly_bizday(cal, day, need);
+
+		if (days > 0)
+			offdays = count_offdays(cal, day + 1, result);
+		else
+			offdays = count_offdays(cal, result, day - 1);
+
+		if (need == (days > 0 ? (int64) days + offdays : (int64) days - offdays))
+			break;
+
+		need = days > 0 ? (int64) days + offdays : (int64) days - offdays;
+	}
+
+	return result;
+}
+
+
+static int
+ora_diff_bizdays(BizCalendar *cal, DateADT day1, DateADT day2)
+{
+	int days;
+
+	DateADT aux_day;
+	if (day1 > day2)
+	{
+		aux_day = day1;
+		day1 = day2; day2 = aux_day;
+	}
+
+	days = count_bizdays(cal, day1, day2);
+
 	/*
 	 * decrease result when first day was bizday, but we don't want
 	 * calculate first day.
 	 */
-	if ( start_is_bizday && !include_start && days > 0)
+	if (!include_start && days > 0 && is_bizday(cal, day1))
 		days -= 1;
 
 	return days;
 }
 
 
+/*
+ * Named calendars are stored in tables plvdate.calendar, calendar_holiday,
+ * calendar_feast and calendar_exception. They are loaded once per backend
+ * and cached. The statement triggers on these tables send relcache
+ * invalidation, and the cached calendars are released after any change.
+ */
+#define CALENDAR_TABLES		4
+
+static BizCalendar *named_calendars = NULL;
+static bool named_calendars_valid = false;
+static bool calendar_callback_registered = false;
+static Oid calendar_relids[CALENDAR_TABLES];
+
+static void
+calendar_relcache_callback(Datum arg, Oid relid)
+{
+	int i;
+
+	if (relid == InvalidOid)
+	{
+		named_calendars_valid = false;
+		return;
+	}
+
+	for (i = 0; i < CALENDAR_TABLES; i++)
+		if (calendar_relids[i] == relid)
+			named_calendars_valid = false;
+}
+
+static void
+free_named_calendars(void)
+{
+	while (named_calendars != NULL)
+	{
+		BizCalendar *cal = named_calendars;
+
+		named_calendars = cal->next;
+
+		reset_year_cache(cal);
+		pfree(cal->name);
+		pfree(cal->holidays);
+		pfree(cal->exceptions);
+		pfree(cal->feasts);
+		pfree(cal);
+	}
+}
+
+static Datum *
+get_array_elements(Datum value, Oid elmtype, int *nelems)
+{
+	int16 typlen;
+	bool typbyval;
+	char typalign;
+	Datum *elems;
+
+	get_typlenbyvalalign(elmtype, &typlen, &typbyval, &typalign);
+	deconstruct_array(DatumGetArrayTypeP(value), elmtype,
+					  typlen, typbyval, typalign,
+					  &elems, NULL, nelems);
+
+	return elems;
+}
+
+static BizCalendar *
+load_calendar(const char *name)
+{
+	static SPIPlanPtr plan = NULL;
+
+	Oid argtypes[] = {TEXTOID};
+	Datum values[1];
+	char nulls[1] = {' '};
+	HeapTuple tuple;
+	TupleDesc tupdesc;
+	BizCalendar *cal;
+	unsigned char nonbizdays = 0;
+	Datum *elems;
+	Datum *elems2;
+	bool isnull;
+	int n;
+	int i;
+
+	values[0] = CStringGetTextDatum(name);
+
+	if (SPI_connect() < 0)
+		ereport(ERROR,
+			(errcode(ERRCODE_INTERNAL_ERROR),
+			 errmsg("SPI_connect failed")));
+
+	if (!plan)
+	{
+		SPIPlanPtr p = SPI_prepare(
+			"SELECT c.nonbizdays, c.use_easter, c.use_great_friday,"
+			"       ARRAY(SELECT h.month FROM plvdate.calendar_holiday h"
+			"              WHERE h.calendar = c.name ORDER BY h.month, h.day),"
+			"       ARRAY(SELECT h.day FROM plvdate.calendar_holiday h"
+			"              WHERE h.calendar = c.name ORDER BY h.month, h.day),"
+			"       ARRAY(SELECT f.easter_offset FROM plvdate.calendar_feast f"
+			"              WHERE f.calendar = c.name),"
+			"       ARRAY(SELECT e.day FROM plvdate.calendar_exception e"
+			"              WHERE e.calendar = c.name ORDER BY e.day),"
+			"       'plvdate.calendar'::regclass::oid,"
+			"       'plvdate.calendar_holiday'::regclass::oid,"
+			"       'plvdate.calendar_feast'::regclass::oid,"
+			"       'plvdate.calendar_exception'::regclass::oid"
+			"  FROM plvdate.calendar c WHERE c.name = $1",
+			1, argtypes);
+
+		if (p == NULL || (plan = SPI_saveplan(p)) == NULL)
+			ereport(ERROR,
+				(errcode(ERRCODE_INTERNAL_ERROR),
+				errmsg("SPI_prepare_failed")));
+	}
+
+	if (SPI_OK_SELECT != SPI_execute_plan(plan, values, nulls, true, 1))
+		ereport(ERROR,
+			(errcode(ERRCODE_INTERNAL_ERROR),
+			 errmsg("can't execute sql")));
+
+	if (SPI_processed == 0)
+		ereport(ERROR,
+			(errcode(ERRCODE_UNDEFINED_OBJECT),
+			 errmsg("calendar \"%s\" does not exist", name)));
+
+	tuple = SPI_tuptable->vals[0];
+	tupdesc = SPI_tuptable->tupdesc;
+
+	elems = get_array_elements(SPI_getbinval(tuple, tupdesc, 1, &isnull), TEXTOID, &n);
+	for (i = 0; i < n; i++)
+	{
+		text *day_txt = DatumGetTextPP(elems[i]);
+		int d = ora_seq_search(VARDATA_ANY(day_txt), ora_days, VARSIZE_ANY_EXHDR(day_txt));
+
+		CHECK_SEQ_SEARCH(d, "DAY/Day/day");
+		nonbizdays |= 1 << d;
+	}
+
+	if (nonbizdays == 0x7f)
+		ereport(ERROR,
+			    (errcode(ERRCODE_DATA_EXCEPTION),
+			     errmsg("nonbizday registeration error"),
+			     errdetail("Constraint violation."),
+			     errhint("One day in week have to be bizday.")));
+
+	cal = MemoryContextAllocZero(TopMemoryContext, sizeof(BizCalendar));
+	cal->nonbizdays = nonbizdays;
+	cal->country_id = -1;
+
+	cal->use_easter = DatumGetBool(SPI_getbinval(tuple, tupdesc, 2, &isnull));
+	cal->use_great_friday = DatumGetBool(SPI_getbinval(tuple, tupdesc, 3, &isnull));
+
+	elems = get_array_elements(SPI_getbinval(tuple, tupdesc, 4, &isnull), INT4OID, &n);
+	elems2 = get_array_elements(SPI_getbinval(tuple, tupdesc, 5, &isnull), INT4OID, &n);
+	cal->holidays = MemoryContextAlloc(TopMemoryContext, (n + 1) * sizeof(holiday_desc));
+	for (i = 0; i < n; i++)
+	{
+		cal->holidays[i].month = (char) DatumGetInt32(elems[i]);
+		cal->holidays[i].day = (char) DatumGetInt32(elems2[i]);
+	}
+	cal->holidays_c = n;
+
+	elems = get_array_elements(SPI_getbinval(tuple, tupdesc, 6, &isnull), INT4OID, &n);
+	cal->feasts = MemoryContextAlloc(TopMemoryContext, (n + 1) * sizeof(int));
+	for (i = 0; i < n; i++)
+		cal->feasts[i] = DatumGetInt32(elems[i]);
+	cal->feasts_c = n;
+
+	elems = get_array_elements(SPI_getbinval(tuple, tupdesc, 7, &isnull), DATEOID, &n);
+	cal->exceptions = MemoryContextAlloc(TopMemoryContext, (n + 1) * sizeof(DateADT));
+	for (i = 0; i < n; i++)
+		cal->exceptions[i] = DatumGetDateADT(elems[i]);
+	cal->exceptions_c = n;
+
+	for (i = 0; i < CALENDAR_TABLES; i++)
+		calendar_relids[i] = DatumGetObjectId(SPI_getbinval(tuple, tupdesc, 8 + i, &isnull));
+
+	cal->name = MemoryContextStrdup(TopMemoryContext, name);
+
+	SPI_finish();
+
+	return cal;
+}
+
+static BizCalendar *
+get_named_calendar(text *name_txt)
+{
+	char *name = text_to_cstring(name_txt);
+	BizCalendar *cal;
+
+	if (!calendar_callback_registered)
+	{
+		CacheRegisterRelcacheCallback(calendar_relcache_callback, (Datum) 0);
+		calendar_callback_registered = true;
+	}
+
+	if (!named_calendars_valid)
+	{
+		free_named_calendars();
+		named_calendars_valid = true;
+	}
+
+	for (cal = named_calendars; cal != NULL; cal = cal->next)
+	{
+		if (strcmp(cal->name, name) == 0)
+			break;
+	}
+
+	if (cal == NULL)
+	{
+		cal = load_calendar(name);
+		cal->next = named_calendars;
+		named_calendars = cal;
+	}
+
+	pfree(name);
+
+	return cal;
+}
+
+/*
+ * Returns named calendar, when the function has the calendar argument,
+ * else returns session calendar.
+ */
+static BizCalendar *
+get_calendar(FunctionCallInfo fcinfo, int argno)
+{
+	if (PG_NARGS() > argno)
+		return get_named_calendar(PG_GETARG_TEXT_PP(argno));
+
+	return &session_calendar;
+}
+
+/*
+ * Statement trigger on calendar tables. Sends relcache invalidation,
+ * so all backends drop their cached named calendars.
+ */
+Datum
+plvdate_calendar_changed(PG_FUNCTION_ARGS)
+{
+	TriggerData *trigdata = (TriggerData *) fcinfo->context;
+
+	if (!CALLED_AS_TRIGGER(fcinfo))
+		ereport(ERROR,
+			(errcode(ERRCODE_E_R_I_E_TRIGGER_PROTOCOL_VIOLATED),
+			 errmsg("function \"plvdate_calendar_changed\" was not called by trigger manager")));
+
+	CacheInvalidateRelcache(trigdata->tg_relation);
+
+	return PointerGetDatum(NULL);
+}
+
+
 /****************************************************************
  * PLVdate.add_bizdays
  *
  * Syntax:
  *   FUNCTION add_bizdays(IN dt DATE, IN days int) RETURNS DATE;
+ *   FUNCTION add_bizdays(IN dt DATE, IN days int, IN calendar text)
+ *     RETURNS DATE;
  *
  * Purpouse:
  *   Get the date created by adding <n> business days to a date
@@ -365,8 +1077,9 @@ plvdate_add_bizdays (PG_FUNCTION_ARGS)
 {
 	DateADT day = PG_GETARG_DATEADT(0);
 	int days = PG_GETARG_INT32(1);
+	BizCalendar *cal = get_calendar(fcinfo, 2);
 
-	PG_RETURN_DATEADT(ora_add_bizdays(day,days));
+	PG_RETURN_DATEADT(ora_add_bizdays(cal, day, days));
 }
 
 
@@ -375,6 +1088,7 @@ plvdate_add_bizdays (PG_FUNCTION_ARGS)
  *
  * Syntax:
  *   FUNCTION nearest_bizday(IN dt DATE) RETURNS DATE;
+ *   FUNCTION nearest_bizday(IN dt DATE, IN calendar text) RETURNS DATE;
  *
  * Purpouse:
  *   Get the nearest business date to a given date, user defined
@@ -385,10 +1099,11 @@ Datum
 plvdate_nearest_bizday (PG_FUNCTION_ARGS)
 {
 	DateADT dt = PG_GETARG_DATEADT(0);
+	BizCalendar *cal = get_calendar(fcinfo, 1);
 	DateADT d1, d2, res;
 
-	d1 = ora_add_bizdays(dt, -1);
-	d2 = ora_add_bizdays(dt, 1);
+	d1 = step_bizday(cal, dt, -1);
+	d2 = step_bizday(cal, dt, 1);
 
 	if ((dt - d1) > (d2 - dt))
 		res = d2;
@@ -404,6 +1119,7 @@ plvdate_nearest_bizday (PG_FUNCTION_ARGS)
  *
  * Syntax:
  *   FUNCTION next_bizday(IN dt DATE) RETURNS DATE;
+ *   FUNCTION next_bizday(IN dt DATE, IN calendar text) RETURNS DATE;
  *
  * Purpouse:
  *   Get the next business date from a given date, user defined
@@ -414,8 +1130,9 @@ Datum
 plvdate_next_bizday (PG_FUNCTION_ARGS)
 {
 	DateADT day = PG_GETARG_DATEADT(0);
+	BizCalendar *cal = get_calendar(fcinfo, 1);
 
-	PG_RETURN_DATEADT(ora_add_bizdays(day,1));
+	PG_RETURN_DATEADT(step_bizday(cal, day, 1));
 }
 
 
@@ -425,6 +1142,8 @@ plvdate_next_bizday (PG_FUNCTION_ARGS)
  * Syntax:
  *   FUNCTION bizdays_between(IN dt1 DATE, IN dt2 DATE)
  *     RETURNS int;
+ *   FUNCTION bizdays_between(IN dt1 DATE, IN dt2 DATE, IN calendar text)
+ *     RETURNS int;
  *
  * Purpouse:
  *   Get the number of business days between two dates
@@ -436,8 +1155,9 @@ plvdate_bizdays_between (PG_FUNCTION_ARGS)
 {
 	DateADT day1 = PG_GETARG_DATEADT(0);
 	DateADT day2 = PG_GETARG_DATEADT(1);
+	BizCalendar *cal = get_calendar(fcinfo, 2);
 
-	PG_RETURN_INT32(ora_diff_bizdays(day1,day2));
+	PG_RETURN_INT32(ora_diff_bizdays(cal, day1, day2));
 }
 
 
@@ -446,6 +1166,7 @@ plvdate_bizdays_between (PG_FUNCTION_ARGS)
  *
  * Syntax:
  *   FUNCTION prev_bizday(IN dt DATE) RETURNS date;
+ *   FUNCTION prev_bizday(IN dt DATE, IN calendar text) RETURNS date;
  *
  * Purpouse:
  *   Get the previous business date from a given date, user
@@ -457,8 +1178,9 @@ Datum
 plvdate_prev_bizday (PG_FUNCTION_ARGS)
 {
 	DateADT day = PG_GETARG_DATEADT(0);
+	BizCalendar *cal = get_calendar(fcinfo, 1);
 
-	PG_RETURN_DATEADT(ora_add_bizdays(day,-1));
+	PG_RETURN_DATEADT(step_bizday(cal, day, -1));
 }
 
 
@@ -467,6 +1189,7 @@ plvdate_prev_bizday (PG_FUNCTION_ARGS)
  *
  * Syntax:
  *   FUNCTION isbizday(IN dt DATE) RETURNS bool;
+ *   FUNCTION isbizday(IN dt DATE, IN calendar text) RETURNS bool;
  *
  * Purpouse:
  *   Call this function to determine if a date is a business day
@@ -477,24 +1200,9 @@ Datum
 plvdate_isbizday (PG_FUNCTION_ARGS)
 {
 	DateADT day = PG_GETARG_DATEADT(0);
-	int y, m, d;
-	holiday_desc hd;
-
-	if (0 != ((1 << j2day(day+POSTGRES_EPOCH_JDATE)) & nonbizdays))
-		return false;
-
-	if (NULL != bsearch(&day, exceptions, exceptions_c,
-						sizeof(DateADT), dateadt_comp))
-		return false;
-
-	j2date(day + POSTGRES_EPOCH_JDATE, &y, &m, &d);
-	hd.month = m; hd.day = d;
+	BizCalendar *cal = get_calendar(fcinfo, 1);
 
-	if (easter_holidays(day, y, m))
-		return false;
-
-	PG_RETURN_BOOL (NULL == bsearch(&hd, holidays, holidays_c,
-									sizeof(holiday_desc), holiday_desc_comp));
+	PG_RETURN_BOOL(is_bizday(cal, day));
 }
 
 
@@ -519,7 +1227,7 @@ plvdate_set_nonbizday_dow (PG_FUNCTION_ARGS)
 	int d = ora_seq_search(VARDATA_ANY(day_txt), ora_days, VARSIZE_ANY_EXHDR(day_txt));
 	CHECK_SEQ_SEARCH(d, "DAY/Day/day");
 
-	check = nonbizdays | (1 << d);
+	check = session_calendar.nonbizdays | (1 << d);
 	if (check == 0x7f)
 		ereport(ERROR,
 			    (errcode(ERRCODE_DATA_EXCEPTION),
@@ -527,7 +1235,8 @@ plvdate_set_nonbizday_dow (PG_FUNCTION_ARGS)
 			     errdetail("Constraint violation."),
 			     errhint("One day in week have to be bizday.")));
 
-	nonbizdays = nonbizdays | (1 << d);
+	session_calendar.nonbizdays = session_calendar.nonbizdays | (1 << d);
+	reset_year_cache(&session_calendar);
 
 	PG_RETURN_VOID();
 }
@@ -551,7 +1260,8 @@ plvdate_unset_nonbizday_dow (PG_FUNCTION_ARGS)
 	int d = ora_seq_search(VARDATA_ANY(day_txt), ora_days, VARSIZE_ANY_EXHDR(day_txt));
 	CHECK_SEQ_SEARCH(d, "DAY/Day/day");
 
-	nonbizdays = (nonbizdays | (1 << d)) ^ (1 << d);
+	session_calendar.nonbizdays = (session_calendar.nonbizdays | (1 << d)) ^ (1 << d);
+	reset_year_cache(&session_calendar);
 
 	PG_RETURN_VOID();
 }
@@ -579,7 +1289,7 @@ plvdate_set_nonbizday_day (PG_FUNCTION_ARGS)
 
 	if (arg2)
 	{
-		if (holidays_c == MAX_holidays)
+		if (session_calendar.holidays_c == MAX_holidays)
 			ereport(ERROR,
 				    (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
 				     errmsg("nonbizday registeration error"),
@@ -589,37 +1299,39 @@ plvdate_set_nonbizday_day (PG_FUNCTION_ARGS)
 		j2date(arg1 + POSTGRES_EPOCH_JDATE, &y, &m, &d);
 		hd.month = m; hd.day = d;
 
-		if (NULL != bsearch(&hd, holidays, holidays_c, sizeof(holiday_desc), holiday_desc_comp))
+		if (NULL != bsearch(&hd, holidays, session_calendar.holidays_c, sizeof(holiday_desc), holiday_desc_comp))
 			ereport(ERROR,
 				    (errcode(ERRCODE_DUPLICATE_OBJECT),
 				     errmsg("nonbizday registeration error"),
 				     errdetail("Date is registered.")));
 
-		holidays[holidays_c].month = m;
-		holidays[holidays_c].day = d;
-		holidays_c += 1;
+		holidays[session_calendar.holidays_c].month = m;
+		holidays[session_calendar.holidays_c].day = d;
+		session_calendar.holidays_c += 1;
 
-		qsort(holidays, holidays_c, sizeof(holiday_desc), holiday_desc_comp);
+		qsort(holidays, session_calendar.holidays_c, sizeof(holiday_desc), holiday_desc_comp);
 	}
 	else
 	{
-		if (exceptions_c == MAX_EXCEPTIONS)
+		if (session_calendar.exceptions_c == MAX_EXCEPTIONS)
 			ereport(ERROR,
 				    (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
 				     errmsg("nonbizday registeration error"),
 				     errdetail("Too much registered nonrepeated nonbizdays."),
 				     errhint("Increase MAX_EXCEPTIONS in 'plvdate.c'.")));
 
-		if (NULL != bsearch(&arg1, exceptions, exceptions_c, sizeof(DateADT), dateadt_comp))
+		if (NULL != bsearch(&arg1, exceptions, session_calendar.exceptions_c, sizeof(DateADT), dateadt_comp))
 			ereport(ERROR,
 				    (errcode(ERRCODE_DUPLICATE_OBJECT),
 				     errmsg("nonbizday registeration error"),
 				     errdetail("Date is registered.")));
 
-		exceptions[exceptions_c++] = arg1;
-		qsort(exceptions, exceptions_c, sizeof(DateADT), dateadt_comp);
+		exceptions[session_calendar.exceptions_c++] = arg1;
+		qsort(exceptions, session_calendar.exceptions_c, sizeof(DateADT), dateadt_comp);
 	}
 
+	reset_year_cache(&session_calendar);
+
 	PG_RETURN_VOID();
 }
 
@@ -648,7 +1360,7 @@ plvdate_unset_nonbizday_day (PG_FUNCTION_ARGS)
 	if (arg2)
 	{
 		j2date(arg1 + POSTGRES_EPOCH_JDATE, &y, &m, &d);
-		for (i = 0; i < holidays_c; i++)
+		for (i = 0; i < session_calendar.holidays_c; i++)
 		{
 			if (!found && holidays[i].month == m && holidays[i].day == d)
 				found = true;
@@ -659,17 +1371,17 @@ plvdate_unset_nonbizday_day (PG_FUNCTION_ARGS)
 			}
 		}
 		if (found)
-			holidays_c -= 1;
+			session_calendar.holidays_c -= 1;
 	}
 	else
 	{
-		for (i = 0; i < exceptions_c; i++)
+		for (i = 0; i < session_calendar.exceptions_c; i++)
 			if (!found && exceptions[i] == arg1)
 				found = true;
 			else if (found)
 				exceptions[i-1] = exceptions[i];
 		if (found)
-			exceptions_c -= 1;
+			session_calendar.exceptions_c -= 1;
 	}
 	if (!found)
 		ereport(ERROR,
@@ -677,6 +1389,8 @@ plvdate_unset_nonbizday_day (PG_FUNCTION_ARGS)
 			     errmsg("nonbizday unregisteration error"),
 			     errdetail("Nonbizday not found.")));
 
+	reset_year_cache(&session_calendar);
+
 	PG_RETURN_VOID();
 }
 
@@ -697,7 +1411,8 @@ plvdate_unset_nonbizday_day (PG_FUNCTION_ARGS)
 Datum
 plvdate_use_easter (PG_FUNCTION_ARGS)
 {
-	use_easter = PG_GETARG_BOOL(0);
+	session_calendar.use_easter = PG_GETARG_BOOL(0);
+	reset_year_cache(&session_calendar);
 
 	PG_RETURN_VOID();
 }
@@ -717,7 +1432,7 @@ plvdate_use_easter (PG_FUNCTION_ARGS)
 Datum
 plvdate_using_easter (PG_FUNCTION_ARGS)
 {
-	PG_RETURN_BOOL(use_easter);
+	PG_RETURN_BOOL(session_calendar.use_easter);
 }
 
 
@@ -737,7 +1452,8 @@ plvdate_using_easter (PG_FUNCTION_ARGS)
 Datum
 plvdate_use_great_friday (PG_FUNCTION_ARGS)
 {
-	use_great_friday = PG_GETARG_BOOL(0);
+	session_calendar.use_great_friday = PG_GETARG_BOOL(0);
+	reset_year_cache(&session_calendar);
 
 	PG_RETURN_VOID();
 }
@@ -757,7 +1473,7 @@ plvdate_use_great_friday (PG_FUNCTION_ARGS)
 Datum
 plvdate_using_great_friday (PG_FUNCTION_ARGS)
 {
-	PG_RETURN_BOOL(use_great_friday);
+	PG_RETURN_BOOL(session_calendar.use_great_friday);
 }
 
 
@@ -811,16 +1527,18 @@ plvdate_default_holidays (PG_FUNCTION_ARGS)
 {
 	text *country = PG_GETARG_TEXT_PP(0);
 
-	country_id = ora_seq_search(VARDATA_ANY(country), states, VARSIZE_ANY_EXHDR(country));
-	CHECK_SEQ_SEARCH(country_id, "STATE/State/state");
+	session_calendar.country_id = ora_seq_search(VARDATA_ANY(country), states, VARSIZE_ANY_EXHDR(country));
+	CHECK_SEQ_SEARCH(session_calendar.country_id, "STATE/State/state");
+
+	session_calendar.nonbizdays = defaults_ci[session_calendar.country_id].nonbizdays;
+	session_calendar.use_easter = defaults_ci[session_calendar.country_id].use_easter;
+	session_calendar.use_great_friday = defaults_ci[session_calendar.country_id].use_great_friday;
+	session_calendar.exceptions_c = 0;
 
-	nonbizdays = defaults_ci[country_id].nonbizdays;
-	use_easter = defaults_ci[country_id].use_easter;
-	use_great_friday = defaults_ci[country_id].use_great_friday;
-	exceptions_c = 0;
+	session_calendar.holidays_c = defaults_ci[session_calendar.country_id].holidays_c;
+	memcpy(holidays, defaults_ci[session_calendar.country_id].holidays, session_calendar.holidays_c*sizeof(holiday_desc));
 
-	holidays_c = defaults_ci[country_id].holidays_c;
-	memcpy(holidays, defaults_ci[country_id].holidays, holidays_c*sizeof(holiday_desc));
+	reset_year_cache(&session_calendar);
 
 	PG_RETURN_VOID();
 }
@@ -15,76 +15,38 @@
 #include <stdlib.h>
 
 #include "postgres.h"
+#if PG_VERSION_NUM >= 90300
+#include "access/htup_details.h"
+#endif
 #include "catalog/pg_type.h"
 #include "lib/stringinfo.h"
+#include "miscadmin.h"
 #include "nodes/pg_list.h"
 #include "utils/date.h"
 #include "utils/builtins.h"
 #include "utils/nabstime.h"
+#include "utils/tuplestore.h"
 #include "plvlex.h"
 #include "sqlparse.h"
 #include "funcapi.h"
 #include "orafce.h"
 #include "builtins.h"
 
-typedef struct {
-	List	*nodes;
-	int 	nnodes;
-	int	cnode;
-	char **values;
-} tokensFctx;
-
 PG_FUNCTION_INFO_V1(plvlex_tokens);
-
-extern int      orafce_sql_yyparse();
-extern void orafce_sql_yyerror(List **result, const char *message);
-extern void orafce_sql_scanner_init(const char *str);
-extern void orafce_sql_scanner_finish(void);
+PG_FUNCTION_INFO_V1(plvlex_fingerprint);
 
 static orafce_lexnode *__node;
 
-static char *__result;
-static int __len;
-
-#define CSTRING(txt) \
-	( \
-    __len = VARSIZE(txt) - VARHDRSZ, \
-    __result = palloc(__len + 1), \
-    memcpy(__result, VARDATA(txt), __len), \
-    __result[__len] = '\0', \
-    __result)
-
-
-#define COPY_TO_S(src,dest,col)	(dest->col = (src->col ? pstrdup(src->col) : NULL))
-#define COPY_TO(src,dest,col)	(dest->col = src->col)
-
-#define COPY_FIELDS(src,dest) \
-	COPY_TO(src, dest, typenode), \
-	COPY_TO_S(src,dest,str), \
-	COPY_TO(src,dest,keycode), \
-	COPY_TO(src,dest,lloc), \
-	COPY_TO_S(src,dest,sep), \
-	COPY_TO(src,dest,modificator), \
-	COPY_TO(src,dest,classname)
-
-
 #define COPY_NODE(src)   \
   ( \
     __node = (orafce_lexnode*) palloc(sizeof(orafce_lexnode)),  \
-    COPY_FIELDS(src,__node), \
+    *__node = *(src), \
     __node)
 
 
 /* Finding triplet a.b --> a */
 
 #define IsType(node, type)	(node->typenode == X_##type)
-#define APPEND_NODE(list,nd)	\
-	if (nd) \
-	{ \
-		list = lappend(list, nd); \
-		nd = NULL; \
-	}
-
 #define mod(a)  (a->modificator)
 #define SF(a)	(a ? a : "")
 
@@ -129,56 +91,87 @@ compose(orafce_lexnode *a, orafce_lexnode *b)
 	return result;
 }
 
-static List *
-filterList(List *list, bool skip_spaces, bool qnames)
+/*
+ * Tokens are filtered and stored one by one, only an identifier and
+ * a dot are buffered for composing qualified names.
+ */
+typedef struct
+{
+	bool		skip_spaces;
+	bool		qnames;
+	orafce_lexnode *a;
+	orafce_lexnode *dot;
+	Tuplestorestate *tupstore;
+	TupleDesc	tupdesc;
+} TokensState;
+
+static void
+store_node(TokensState *state, orafce_lexnode *nd)
 {
-	List *result = NIL;
-	ListCell *cell;
-	bool isdot = false;
-	orafce_lexnode *a = NULL;
-	orafce_lexnode *dot = NULL;
+	Datum		values[6];
+	bool		nulls[6];
+
+	memset(nulls, 0, sizeof(nulls));
+
+	values[0] = Int32GetDatum(nd->lloc);
+	values[1] = CStringGetTextDatum(SF(nd->str));
+	values[2] = Int32GetDatum(nd->keycode);
+	values[3] = CStringGetTextDatum(nd->classname);
 
-	foreach(cell, list)
+	if (nd->keycode == -1)
+		nulls[2] = true;
+
+	if (nd->sep)
+		values[4] = CStringGetTextDatum(nd->sep);
+	else
+		nulls[4] = true;
+
+	if (nd->modificator)
+		values[5] = CStringGetTextDatum(nd->modificator);
+	else
+		nulls[5] = true;
+
+	tuplestore_putvalues(state->tupstore, state->tupdesc, values, nulls);
+}
+
+#define STORE_NODE(state,nd)	\
+	if (nd) \
+	{ \
+		store_node(state, nd); \
+		nd = NULL; \
+	}
+
+static void
+filter_node(TokensState *state, orafce_lexnode *nd)
+{
+	if (state->qnames)
 	{
-		orafce_lexnode *nd = (orafce_lexnode *) lfirst(cell);
+		bool	isdot = (IsType(nd, OTHERS) && (nd->str[0] == '.'));
 
-		if (qnames)
+		if (IsType(nd, IDENT) && state->dot && state->a)
 		{
-			isdot = (IsType(nd, OTHERS) && (nd->str[0] == '.'));
-
-			if (IsType(nd, IDENT) && dot && a)
-			{
-				a = compose(a, nd);
-				dot = NULL;
-				continue;
-			}
-			else if (isdot && !dot && a)
-			{
-				dot = COPY_NODE(nd);
-				continue;
-			}
-			else if (IsType(nd, IDENT) && !a)
-			{
-				a = COPY_NODE(nd);
-				continue;
-			}
+			state->a = compose(state->a, nd);
+			state->dot = NULL;
+			return;
 		}
-
-		/* clean buffered values */
-		APPEND_NODE(result,a);
-		APPEND_NODE(result,dot);
-
-		if (!(skip_spaces && IsType(nd, WHITESPACE)))
+		else if (isdot && !state->dot && state->a)
 		{
-			result = lappend(result, COPY_NODE(nd));
+			state->dot = COPY_NODE(nd);
+			return;
+		}
+		else if (IsType(nd, IDENT) && !state->a)
+		{
+			state->a = COPY_NODE(nd);
+			return;
 		}
 	}
 
 	/* clean buffered values */
-	APPEND_NODE(result,a);
-	APPEND_NODE(result,dot);
+	STORE_NODE(state, state->a);
+	STORE_NODE(state, state->dot);
 
-	return result;
+	if (!(state->skip_spaces && IsType(nd, WHITESPACE)))
+		store_node(state, nd);
 }
 
 Datum
@@ -190,108 +183,217 @@ plvlex_tokens(PG_FUNCTION_ARGS)
 			 errmsg("plvlex.tokens is not available in the built")));
 	PG_RETURN_VOID();
 #else
-	FuncCallContext	   *funcctx;
-	TupleDesc			tupdesc;
-	TupleTableSlot	   *slot;
-	AttInMetadata	   *attinmeta;
-	tokensFctx		   *fctx;
+	ReturnSetInfo	   *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	text			   *src = PG_GETARG_TEXT_PP(0);
+	TokensState			state;
+	orafce_sql_scanner *scanner;
+	orafce_lexnode		nd;
+	bool				found = false;
+	MemoryContext		oldcontext;
 
+	/* tokens are pulled from the scanner and stored immediately */
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
 
-	if (SRF_IS_FIRSTCALL ())
-	{
-		MemoryContext  oldcontext;
-		List *lexems;
-		text *src = PG_GETARG_TEXT_P(0);
-		bool skip_spaces = PG_GETARG_BOOL(1);
-		bool qnames = PG_GETARG_BOOL(2);
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not allowed in this context")));
 
-		orafce_sql_scanner_init(CSTRING(src));
-		if (orafce_sql_yyparse(&lexems) != 0)
-			orafce_sql_yyerror(NULL, "bogus input");
+	state.skip_spaces = PG_GETARG_BOOL(1);
+	state.qnames = PG_GETARG_BOOL(2);
+	state.a = NULL;
+	state.dot = NULL;
 
-		orafce_sql_scanner_finish();
+	oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
 
-		funcctx = SRF_FIRSTCALL_INIT ();
-		oldcontext = MemoryContextSwitchTo (funcctx->multi_call_memory_ctx);
+	state.tupdesc = CreateTemplateTupleDesc (6 , false);
 
-		fctx = (tokensFctx*) palloc (sizeof (tokensFctx));
-		funcctx->user_fctx = (void *)fctx;
+	TupleDescInitEntry (state.tupdesc,  1, "start_pos", INT4OID, -1, 0);
+	TupleDescInitEntry (state.tupdesc,  2, "token",     TEXTOID, -1, 0);
+	TupleDescInitEntry (state.tupdesc,  3, "keycode",   INT4OID, -1, 0);
+	TupleDescInitEntry (state.tupdesc,  4, "class",     TEXTOID, -1, 0);
+	TupleDescInitEntry (state.tupdesc,  5, "separator", TEXTOID, -1, 0);
+	TupleDescInitEntry (state.tupdesc,  6, "mod",       TEXTOID, -1, 0);
 
-		fctx->nodes = filterList(lexems, skip_spaces, qnames);
-		fctx->nnodes = list_length(fctx->nodes);
-		fctx->cnode = 0;
+	state.tupstore = tuplestore_begin_heap((rsinfo->allowedModes & SFRM_Materialize_Random) != 0,
+										   false, work_mem);
 
-		fctx->values = (char **) palloc (6 * sizeof (char *));
-		fctx->values  [0] = (char*) palloc (16 * sizeof (char));
-		fctx->values  [1] = (char*) palloc (1024 * sizeof (char));
-		fctx->values  [2] = (char*) palloc (16 * sizeof (char));
-		fctx->values  [3] = (char*) palloc (16 * sizeof (char));
-		fctx->values  [4] = (char*) palloc (255 * sizeof (char));
-		fctx->values  [5] = (char*) palloc (255 * sizeof (char));
+	MemoryContextSwitchTo(oldcontext);
 
-		tupdesc = CreateTemplateTupleDesc (6 , false);
+	scanner = orafce_sql_scanner_create(VARDATA_ANY(src), VARSIZE_ANY_EXHDR(src));
 
-		TupleDescInitEntry (tupdesc,  1, "start_pos", INT4OID, -1, 0);
-		TupleDescInitEntry (tupdesc,  2, "token",     TEXTOID, -1, 0);
-		TupleDescInitEntry (tupdesc,  3, "keycode",   INT4OID, -1, 0);
-		TupleDescInitEntry (tupdesc,  4, "class",     TEXTOID, -1, 0);
-		TupleDescInitEntry (tupdesc,  5, "separator", TEXTOID, -1, 0);
-		TupleDescInitEntry (tupdesc,  6, "mod",       TEXTOID, -1, 0);
+	while (orafce_sql_scanner_next(scanner, &nd))
+	{
+		filter_node(&state, &nd);
+		found = true;
+	}
+
+	/* the grammar of plvlex requires at least one token */
+	if (!found)
+		orafce_sql_scanner_error(scanner, "syntax error");
+
+	orafce_sql_scanner_destroy(scanner);
+
+	/* clean buffered values */
+	STORE_NODE(&state, state.a);
+	STORE_NODE(&state, state.dot);
 
-		slot = TupleDescGetSlot (tupdesc);
-		funcctx -> slot = slot;
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = state.tupstore;
+	rsinfo->setDesc = state.tupdesc;
 
-		attinmeta = TupleDescGetAttInMetadata (tupdesc);
-		funcctx -> attinmeta = attinmeta;
+	return (Datum) 0;
+#endif
+}
 
-		MemoryContextSwitchTo (oldcontext);
+/*
+ * Fingerprint is 64bit FNV-1a hash of normalized statement. The comments
+ * and whitespaces are removed, literals and parameters are replaced by "?",
+ * keywords and identifiers are in lower case (the scanner folds them).
+ * The tokens are separated by one space, with exception of qualified names,
+ * typecasts, function calls and lists, so the text stays readable.
+ */
+#define FNV_OFFSET_BASIS	UINT64CONST(0xcbf29ce484222325)
+#define FNV_PRIME			UINT64CONST(0x100000001b3)
+
+typedef struct
+{
+	uint64		hash;
+	StringInfo	out;			/* NULL when only hash is required */
+} FingerprintState;
+
+#define IsSelf(node, c)	(IsType(node, OTHERS) && node->str && \
+						 node->str[0] == (c) && node->str[1] == '\0')
+#define IsTypecast(node)	(IsType(node, OTHERS) && node->str && \
+							 strcmp(node->str, "::") == 0)
+
+static void
+fingerprint_append(FingerprintState *state, const char *str, int len)
+{
+	int			i;
+
+	for (i = 0; i < len; i++)
+	{
+		state->hash ^= (unsigned char) str[i];
+		state->hash *= FNV_PRIME;
 	}
 
+	if (state->out)
+		appendBinaryStringInfo(state->out, str, len);
+}
 
-	funcctx = SRF_PERCALL_SETUP ();
-	fctx = (tokensFctx*) funcctx->user_fctx;
+/*
+ * Quoted identifier is not quoted in normalized text when quotes are
+ * not necessary, so "foo" and foo have same fingerprint.
+ */
+static void
+fingerprint_ident(FingerprintState *state, const char *ident)
+{
+	const char *ptr;
+	bool		safe;
 
-	while (fctx->cnode < fctx->nnodes)
+	safe = (ident[0] >= 'a' && ident[0] <= 'z') || ident[0] == '_';
+	for (ptr = ident; *ptr && safe; ptr++)
 	{
-		char **values;
-		Datum result;
-		HeapTuple tuple;
-		char *back_vals[6];
+		char		ch = *ptr;
+
+		safe = (ch >= 'a' && ch <= 'z') || (ch >= '0' && ch <= '9') ||
+			ch == '_' || ch == '$';
+	}
 
-		orafce_lexnode *nd = (orafce_lexnode*) list_nth(fctx->nodes, fctx->cnode++);
-		values = fctx->values;
+	if (safe)
+	{
+		fingerprint_append(state, ident, strlen(ident));
+		return;
+	}
 
-		back_vals[2] = values[2];
-		back_vals[4] = values[4];
-		back_vals[5] = values[5];
+	fingerprint_append(state, "\"", 1);
+	for (ptr = ident; *ptr; ptr++)
+	{
+		if (*ptr == '"')
+			fingerprint_append(state, "\"\"", 2);
+		else
+			fingerprint_append(state, ptr, 1);
+	}
+	fingerprint_append(state, "\"", 1);
+}
 
-		snprintf(values[0],    16, "%d", nd->lloc);
-		snprintf(values[1], 10000, "%s", SF(nd->str));
-		snprintf(values[2],    16, "%d", nd->keycode);
-		snprintf(values[3],    16, "%s", nd->classname);
-		snprintf(values[4],   255, "%s", SF(nd->sep));
-		snprintf(values[5],    48, "%s", SF(nd->modificator));
+Datum
+plvlex_fingerprint(PG_FUNCTION_ARGS)
+{
+#ifdef _MSC_VER
+	ereport(ERROR,
+			(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+			 errmsg("plvlex.fingerprint is not available in the built")));
+	PG_RETURN_VOID();
+#else
+	text	   *src = PG_GETARG_TEXT_PP(0);
+	bool		with_text = PG_NARGS() > 1 && PG_GETARG_BOOL(1);
+	FingerprintState state;
+	orafce_sql_scanner *scanner;
+	orafce_lexnode nd;
+	orafce_lexnode *n = &nd;
+	bool		first = true;
+	bool		glue = false;
+	bool		prev_ident = false;
+	TupleDesc	tupdesc;
+	Datum		values[2];
+	bool		nulls[2];
+
+	state.hash = FNV_OFFSET_BASIS;
+	state.out = with_text ? makeStringInfo() : NULL;
+
+	scanner = orafce_sql_scanner_create(VARDATA_ANY(src), VARSIZE_ANY_EXHDR(src));
+
+	while (orafce_sql_scanner_next(scanner, n))
+	{
+		if (!IsType(n, WHITESPACE) && !IsType(n, COMMENT))
+		{
+			if (!first && !glue &&
+				!IsSelf(n, '.') && !IsSelf(n, ',') && !IsSelf(n, ')') &&
+				!IsSelf(n, ';') && !IsTypecast(n) &&
+				!(IsSelf(n, '(') && prev_ident))
+				fingerprint_append(&state, " ", 1);
+
+			if (IsType(n, SCONST) || IsType(n, NCONST) || IsType(n, PARAM))
+				fingerprint_append(&state, "?", 1);
+			else if (IsType(n, IDENT))
+				fingerprint_ident(&state, n->str);
+			else
+				fingerprint_append(&state, SF(n->str), strlen(SF(n->str)));
+
+			first = false;
+			glue = IsSelf(n, '.') || IsSelf(n, '(') || IsTypecast(n);
+			prev_ident = IsType(n, IDENT);
+		}
 
-		if (nd->keycode == -1)
-			values[2] = NULL;
+		if (n->str)
+			pfree(n->str);
+		if (n->sep)
+			pfree(n->sep);
+	}
 
-		if (!nd->sep)
-			values[4] = NULL;
+	orafce_sql_scanner_destroy(scanner);
 
-		if (!nd->modificator)
-			values[5] = NULL;
+	if (PG_NARGS() == 1)
+		PG_RETURN_INT64((int64) state.hash);
 
-		tuple = BuildTupleFromCStrings (funcctx -> attinmeta,
-							fctx -> values);
-		result = TupleGetDatum (funcctx -> slot, tuple);
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
 
-		values[2] = back_vals[2];
-		values[4] = back_vals[4];
-		values[5] = back_vals[5];
+	memset(nulls, 0, sizeof(nulls));
 
-		SRF_RETURN_NEXT (funcctx, result);
-	}
+	values[0] = Int64GetDatum((int64) state.hash);
+	if (with_text)
+		values[1] = PointerGetDatum(cstring_to_text_with_len(state.out->data,
+															 state.out->len));
+	else
+		nulls[1] = true;
 
-	SRF_RETURN_DONE (funcctx);
+	PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(BlessTupleDesc(tupdesc),
+													  values, nulls)));
 #endif
 }
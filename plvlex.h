@@ -1,3 +1,8 @@
+#ifndef PLVLEX_H
+#define PLVLEX_H
+
+#include "nodes/pg_list.h"
+
 typedef struct
 {
 	int		typenode;
@@ -8,3 +13,16 @@ typedef struct
 	char   *modificator;
 	char   *classname;
 } orafce_lexnode;
+
+/* handle of reentrant flex scanner */
+typedef void *orafce_sql_yyscan_t;
+
+typedef struct orafce_sql_scanner orafce_sql_scanner;
+
+/* pull tokenizer, tokens are returned on demand */
+extern orafce_sql_scanner *orafce_sql_scanner_create(const char *str, int len);
+extern bool orafce_sql_scanner_next(orafce_sql_scanner *scanner, orafce_lexnode *node);
+extern void orafce_sql_scanner_error(orafce_sql_scanner *scanner, const char *message);
+extern void orafce_sql_scanner_destroy(orafce_sql_scanner *scanner);
+
+#endif
@@ -13,6 +13,7 @@
 
 
 #include "postgres.h"
+#include "access/tuptoaster.h"
 #include "utils/builtins.h"
 #include "utils/numeric.h"
 #include "string.h"
@@ -21,6 +22,12 @@
 #include "mb/pg_wchar.h"
 #include "nodes/execnodes.h"
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
 #include "catalog/pg_type.h"
 #include "libpq/pqformat.h"
 #include "orafce.h"
@@ -58,6 +65,7 @@ PG_FUNCTION_INFO_V1(oracle_substr2);
 PG_FUNCTION_INFO_V1(oracle_substr3);
 
 static text *ora_substr(Datum str, int start, int len);
+static int utf8_char_offset_from_end(const char *str, int len, int nchars);
 
 #define ora_substr_text(str, start, len) \
 	ora_substr(PointerGetDatum((str)), (start), (len))
@@ -95,71 +103,206 @@ typedef enum
 }  position_mode;
 
 /*
- * Make substring, can handle negative start
+ * Fast character counting
  *
+ * In UTF8 the number of characters is the number of bytes, that are not
+ * continuation bytes (10xxxxxx). Lead bytes are greater than 0xBF when
+ * they are compared as signed chars, so they can be counted by SSE2 or
+ * AVX2 compare in 16 or 32 bytes blocks. Per byte counters cannot
+ * overflow, because they are summed after at most 255 blocks. Without
+ * SIMD the string is processed in 8 bytes words.
  */
-int
-ora_mb_strlen(text *str, char **sizes, int **positions)
+static int
+utf8_count_chars(const char *str, int len)
 {
-	int r_len;
-	int cur_size = 0;
-	int sz;
-	char *p;
-	int cur = 0;
+	const char *p = str;
+	const char *end = str + len;
+	int		count = 0;
+
+#if defined(__AVX2__)
+	{
+		const __m256i threshold = _mm256_set1_epi8((char) 0xBF);
+
+		while (end - p >= 32)
+		{
+			__m256i		acc = _mm256_setzero_si256();
+			int			blocks = Min((end - p) / 32, 255);
+			int			i;
+
+			for (i = 0; i < blocks; i++)
+			{
+				__m256i		v = _mm256_loadu_si256((const __m256i *) p);
+
+				acc = _mm256_sub_epi8(acc, _mm256_cmpgt_epi8(v, threshold));
+				p += 32;
+			}
+
+			acc = _mm256_sad_epu8(acc, _mm256_setzero_si256());
+			count += (int) (_mm256_extract_epi64(acc, 0) +
+							_mm256_extract_epi64(acc, 1) +
+							_mm256_extract_epi64(acc, 2) +
+							_mm256_extract_epi64(acc, 3));
+		}
+	}
+#elif defined(__SSE2__) || defined(_M_X64)
+	{
+		const __m128i threshold = _mm_set1_epi8((char) 0xBF);
+
+		while (end - p >= 16)
+		{
+			__m128i		acc = _mm_setzero_si128();
+			int			blocks = Min((end - p) / 16, 255);
+			int			i;
+
+			for (i = 0; i < blocks; i++)
+			{
+				__m128i		v = _mm_loadu_si128((const __m128i *) p);
+
+				acc = _mm_sub_epi8(acc, _mm_cmpgt_epi8(v, threshold));
+				p += 16;
+			}
+
+			acc = _mm_sad_epu8(acc, _mm_setzero_si128());
+			count += _mm_cvtsi128_si32(acc) +
+					 _mm_cvtsi128_si32(_mm_srli_si128(acc, 8));
+		}
+	}
+#else
+	while (end - p >= 8)
+	{
+		uint64		w;
+		uint64		cont;
 
-	p = VARDATA_ANY(str);
-	r_len = VARSIZE_ANY_EXHDR(str);
+		memcpy(&w, p, 8);
 
-	if (NULL != sizes)
-		*sizes = palloc(r_len * sizeof(char));
-	if (NULL != positions)
-		*positions = palloc(r_len * sizeof(int));
+		/* bit 7 set and bit 6 cleared - continuation byte */
+		cont = (w & ~(w << 1)) & UINT64CONST(0x8080808080808080);
+		count += 8 - (int) (((cont >> 7) * UINT64CONST(0x0101010101010101)) >> 56);
+		p += 8;
+	}
+#endif
 
-	while (cur < r_len)
+	while (p < end)
 	{
-		sz = _pg_mblen(p);
-		if (sizes)
-			(*sizes)[cur_size] = sz;
-		if (positions)
-			(*positions)[cur_size] = cur;
-		cur += sz;
-		p += sz;
-		cur_size += 1;
+		if ((*p++ & 0xC0) != 0x80)
+			count += 1;
+	}
+
+	return count;
+}
+
+/*
+ * Returns length of ASCII prefix of string. ASCII chars are single byte
+ * chars in all server encodings.
+ */
+static int
+ascii_prefix_len(const char *str, int len)
+{
+	const char *p = str;
+	const char *end = str + len;
+
+	while (end - p >= 8)
+	{
+		uint64		w;
+
+		memcpy(&w, p, 8);
+		if (w & UINT64CONST(0x8080808080808080))
+			break;
+		p += 8;
 	}
 
-	return cur_size;
+	while (p < end && !IS_HIGHBIT_SET(*p))
+		p += 1;
+
+	return p - str;
 }
 
+/*
+ * Returns number of characters in string, replacement of
+ * pg_mbstrlen_with_len.
+ */
+int
+ora_mbstrlen_with_len(const char *str, int len)
+{
+	int		prefix;
+
+	if (pg_database_encoding_max_length() == 1)
+		return len;
+
+	/* pure ASCII string is most common case */
+	prefix = ascii_prefix_len(str, len);
+	if (prefix == len)
+		return len;
+
+	if (GetDatabaseEncoding() == PG_UTF8)
+		return prefix + utf8_count_chars(str + prefix, len - prefix);
+
+	return prefix + pg_mbstrlen_with_len(str + prefix, len - prefix);
+}
 
 int
 ora_mb_strlen1(text *str)
 {
-	int r_len;
-	int c;
-	char *p;
+	return ora_mbstrlen_with_len(VARDATA_ANY(str), VARSIZE_ANY_EXHDR(str));
+}
 
-	r_len = VARSIZE_ANY_EXHDR(str);
+/*
+ * Returns number of characters of possibly toasted text. In single byte
+ * encoding the value is not detoasted.
+ */
+static int
+ora_datum_strlen(Datum str)
+{
+	text   *t;
 
 	if (pg_database_encoding_max_length() == 1)
-		return r_len;
+		return toast_raw_datum_size(str) - VARHDRSZ;
 
-	p = VARDATA_ANY(str);
-	c = 0;
-	while (r_len > 0)
-	{
-		int sz;
+	t = DatumGetTextPP(str);
 
-		sz = _pg_mblen(p);
-		p += sz;
-		r_len -= sz;
-		c += 1;
-	}
+	return ora_mbstrlen_with_len(VARDATA_ANY(t), VARSIZE_ANY_EXHDR(t));
+}
+
+/*
+ * Returns substring that starts on nchars-th character from end of UTF8
+ * string. Only the tail of value, that can hold nchars characters, is
+ * fetched and decompressed.
+ */
+static text *
+utf8_substr_tail(Datum str, int nchars, int len)
+{
+	int32	rawlen = toast_raw_datum_size(str) - VARHDRSZ;
+	int32	offset = 0;
+	text   *t;
+	char   *p;
+	int		l;
+	int		b;
+
+	if (nchars < rawlen / pg_database_encoding_max_length())
+		offset = rawlen - nchars * pg_database_encoding_max_length();
+
+	t = DatumGetTextPSlice(str, offset, rawlen - offset);
+	p = VARDATA_ANY(t);
+	l = VARSIZE_ANY_EXHDR(t);
 
-	return c;
+	b = utf8_char_offset_from_end(p, l, nchars);
+	if (b < 0)
+		return cstring_to_text("");
+
+	if (len < 0)
+		return cstring_to_text_with_len(p + b, l - b);
+	else
+		return cstring_to_text_with_len(p + b,
+										pg_mbcharcliplen(p + b, l - b, len));
 }
 
 /*
  * len < 0 means "length is not specified".
+ *
+ * text_substr fetches only necessary slice of toasted value. For negative
+ * start we don't need to count characters of whole value, when we know
+ * length of value (single byte encoding) or when we can read the value
+ * from end (UTF8).
  */
 static text *
 ora_substr(Datum str, int start, int len)
@@ -168,15 +311,22 @@ ora_substr(Datum str, int start, int len)
 		start = 1;	/* 0 is interpreted as 1 */
 	else if (start < 0)
 	{
-		text   *t;
 		int32	n;
 
-		t = DatumGetTextPP(str);
-		n = pg_mbstrlen_with_len(VARDATA_ANY(t), VARSIZE_ANY_EXHDR(t));
+		if (pg_database_encoding_max_length() > 1 &&
+			GetDatabaseEncoding() == PG_UTF8)
+			return utf8_substr_tail(str, -start, len);
+
+		if (pg_database_encoding_max_length() > 1)
+		{
+			/* save detoasted text */
+			str = PointerGetDatum(DatumGetTextPP(str));
+		}
+
+		n = ora_datum_strlen(str);
 		start = n + start + 1;
 		if (start <= 0)
 			return cstring_to_text("");
-		str = PointerGetDatum(t);	/* save detoasted text */
 	}
 
 	if (len < 0)
@@ -187,101 +337,402 @@ ora_substr(Datum str, int start, int len)
 			str, Int32GetDatum(start), Int32GetDatum(len)));
 }
 
-/* simply search algorhitm - can be better */
+/*
+ * Substring search kernel
+ *
+ * Both directions find every occurrence including overlapping ones, so
+ * the nth semantics is same as for naive scan. Short patterns are
+ * searched with memchr on first byte (libc implementation is vectorized),
+ * longer patterns with Boyer-Moore-Horspool. Backward search uses mirrored
+ * Horspool with shift table built from begin of pattern.
+ *
+ * The pattern is preprocessed to OraSearcher. When the pattern is a
+ * constant (usual case), the searcher is cached in fn_extra and reused
+ * for all rows.
+ */
+
+#define HORSPOOL_MIN_PATTERN		4
+
+typedef struct
+{
+	char	   *pat;			/* pattern, not null terminated */
+	int			len;			/* length of pattern in bytes */
+	int			c_len;			/* length of pattern in chars */
+	int			skip[256];		/* forward Horspool shifts */
+	int			bskip[256];		/* backward Horspool shifts */
+} OraSearcher;
+
+/*
+ * Fill searcher for pattern. The pattern is not copied.
+ */
+static void
+searcher_init(OraSearcher *s, char *pat, int len)
+{
+	s->pat = pat;
+	s->len = len;
+	s->c_len = ora_mbstrlen_with_len(pat, len);
+
+	if (len >= HORSPOOL_MIN_PATTERN)
+	{
+		int		i;
+
+		for (i = 0; i < 256; i++)
+		{
+			s->skip[i] = len;
+			s->bskip[i] = len;
+		}
+
+		for (i = 0; i < len - 1; i++)
+			s->skip[(unsigned char) pat[i]] = len - 1 - i;
+		for (i = len - 1; i > 0; i--)
+			s->bskip[(unsigned char) pat[i]] = i;
+	}
+}
+
+#define MAX_CACHED_SEARCHERS	2
+
+/*
+ * Returns searcher for pattern cached in fn_extra. Functions with more
+ * pattern arguments use different slot for every argument. The searcher
+ * is rebuilt only when pattern is changed.
+ */
+static OraSearcher *
+get_cached_searcher(FunctionCallInfo fcinfo, int slot, text *pattern)
+{
+	OraSearcher **cache = (OraSearcher **) fcinfo->flinfo->fn_extra;
+	OraSearcher *s;
+	char	   *pat = VARDATA_ANY(pattern);
+	int			len = VARSIZE_ANY_EXHDR(pattern);
+
+	Assert(slot >= 0 && slot < MAX_CACHED_SEARCHERS);
+
+	if (cache == NULL)
+	{
+		cache = MemoryContextAllocZero(fcinfo->flinfo->fn_mcxt,
+								sizeof(OraSearcher *) * MAX_CACHED_SEARCHERS);
+		fcinfo->flinfo->fn_extra = cache;
+	}
+
+	s = cache[slot];
+	if (s != NULL && s->len == len && memcmp(s->pat, pat, len) == 0)
+		return s;
+
+	if (s != NULL)
+	{
+		pfree(s->pat);
+		pfree(s);
+	}
+
+	s = MemoryContextAlloc(fcinfo->flinfo->fn_mcxt, sizeof(OraSearcher));
+	s->pat = MemoryContextAlloc(fcinfo->flinfo->fn_mcxt, len + 1);
+	memcpy(s->pat, pat, len);
+	searcher_init(s, s->pat, len);
+
+	cache[slot] = s;
 
+	return s;
+}
+
+/*
+ * Returns byte offset of nth occurrence or -1. Pattern cannot be empty.
+ */
 static int
-ora_instr_mb(text *txt, text *pattern, int start, int nth)
+search_forward(const OraSearcher *s, const char *str, int len,
+			   int beg, int nth)
 {
-	int			c_len_txt, c_len_pat;
-	int			b_len_pat;
-	int		   *pos_txt;
-	const char *str_txt, *str_pat;
-	int			beg, end, i, dx;
+	const char *pat = s->pat;
+	int		plen = s->len;
+	int		last_start = len - plen;
 
-	str_txt = VARDATA_ANY(txt);
-	c_len_txt = ora_mb_strlen(txt, NULL, &pos_txt);
-	str_pat = VARDATA_ANY(pattern);
-	b_len_pat = VARSIZE_ANY_EXHDR(pattern);
-	c_len_pat = pg_mbstrlen_with_len(str_pat, b_len_pat);
+	if (beg > last_start)
+		return -1;
 
-	if (start > 0)
+	if (plen < HORSPOOL_MIN_PATTERN)
 	{
-		dx = 1;
-		beg = start - 1;
-		end = c_len_txt - c_len_pat + 1;
-		if (beg >= end)
-			return 0;	/* out of range */
+		const char *p = str + beg;
+		const char *last = str + last_start;
+		char		first = pat[0];
+
+		while (p <= last)
+		{
+			p = memchr(p, first, last - p + 1);
+			if (p == NULL)
+				break;
+			if (memcmp(p + 1, pat + 1, plen - 1) == 0)
+			{
+				if (--nth == 0)
+					return p - str;
+			}
+			p += 1;
+		}
 	}
 	else
 	{
-		dx = -1;
-		beg = Min(c_len_txt + start, c_len_txt - c_len_pat);
-		end = -1;
-		if (beg <= end)
-			return 0;	/* out of range */
+		int		last = plen - 1;
+		unsigned char lastc = (unsigned char) pat[last];
+		int		pos;
+
+		pos = beg;
+		while (pos <= last_start)
+		{
+			unsigned char c = (unsigned char) str[pos + last];
+
+			if (c == lastc && memcmp(str + pos, pat, last) == 0)
+			{
+				if (--nth == 0)
+					return pos;
+			}
+			pos += s->skip[c];
+		}
 	}
 
-	for (i = beg; i != end; i += dx)
+	return -1;
+}
+
+static int
+search_backward(const OraSearcher *s, const char *str, int len,
+				int beg, int nth)
+{
+	const char *pat = s->pat;
+	int		plen = s->len;
+
+	beg = Min(beg, len - plen);
+	if (beg < 0)
+		return -1;
+
+	if (plen < HORSPOOL_MIN_PATTERN)
+	{
+		const char *p;
+		char		first = pat[0];
+
+		for (p = str + beg; p >= str; p--)
+		{
+			if (*p == first && memcmp(p + 1, pat + 1, plen - 1) == 0)
+			{
+				if (--nth == 0)
+					return p - str;
+			}
+		}
+	}
+	else
 	{
-		if (memcmp(str_txt + pos_txt[i], str_pat, b_len_pat) == 0)
+		unsigned char firstc = (unsigned char) pat[0];
+		int		pos;
+
+		pos = beg;
+		while (pos >= 0)
 		{
-			if (--nth == 0)
-				return i + 1;
+			unsigned char c = (unsigned char) str[pos];
+
+			if (c == firstc && memcmp(str + pos + 1, pat + 1, plen - 1) == 0)
+			{
+				if (--nth == 0)
+					return pos;
+			}
+			pos -= s->bskip[c];
 		}
 	}
 
-	return 0;
+	return -1;
 }
 
+/*
+ * Returns byte offset of character with index nchars (counted from zero),
+ * or -1 when string is shorter.
+ */
+static int
+mb_char_offset(const char *str, int len, int nchars)
+{
+	int		offset = 0;
 
-int
-ora_instr(text *txt, text *pattern, int start, int nth)
+	while (nchars-- > 0)
+	{
+		if (offset >= len)
+			return -1;
+		offset += _pg_mblen(str + offset);
+	}
+
+	return offset;
+}
+
+/*
+ * Returns byte offset of nchars-th character counted from end of string,
+ * or -1 when string is shorter. UTF8 only - it depends on possibility to
+ * recognize continuation bytes.
+ */
+static int
+utf8_char_offset_from_end(const char *str, int len, int nchars)
 {
-	int			len_txt, len_pat;
-	const char *str_txt, *str_pat;
-	int			beg, end, i, dx;
+	int		offset = len;
 
-	if (nth <= 0)
-		PARAMETER_ERROR("Four parameter isn't positive.");
+	while (nchars-- > 0)
+	{
+		if (offset <= 0)
+			return -1;
+		offset -= 1;
+		while (offset > 0 && ((unsigned char) str[offset] & 0xC0) == 0x80)
+			offset -= 1;
+	}
 
-	/* Forward for multibyte strings */
-	if (pg_database_encoding_max_length() > 1)
-		return ora_instr_mb(txt, pattern, start, nth);
+	return offset;
+}
 
-	str_txt = VARDATA_ANY(txt);
-	len_txt = VARSIZE_ANY_EXHDR(txt);
-	str_pat = VARDATA_ANY(pattern);
-	len_pat = VARSIZE_ANY_EXHDR(pattern);
+/*
+ * Multibyte instr for encodings, where byte search can find a false match
+ * inside some character. Walks the string char by char, backward search is
+ * done in two passes (count occurrences, then find the requested one), so
+ * we don't need to hold character positions.
+ */
+static int
+ora_instr_mb_walk(const char *str_txt, int len_txt, const OraSearcher *s,
+				  int start, int nth)
+{
+	const char *str_pat = s->pat;
+	int		len_pat = s->len;
+	int		offset;
+	int		i;
+	int		beg;
 
 	if (start > 0)
 	{
-		dx = 1;
 		beg = start - 1;
-		end = len_txt - len_pat + 1;
-		if (beg >= end)
+		offset = mb_char_offset(str_txt, len_txt, beg);
+		if (offset < 0)
 			return 0;	/* out of range */
+
+		for (i = beg; offset + len_pat <= len_txt; i++)
+		{
+			if (memcmp(str_txt + offset, str_pat, len_pat) == 0)
+			{
+				if (--nth == 0)
+					return i + 1;
+			}
+			offset += _pg_mblen(str_txt + offset);
+		}
 	}
 	else
 	{
-		dx = -1;
-		beg = Min(len_txt + start, len_txt - len_pat);
-		end = -1;
-		if (beg <= end)
+		int		c_len_txt;
+		int		matches = 0;
+
+		c_len_txt = ora_mbstrlen_with_len(str_txt, len_txt);
+
+		beg = Min(c_len_txt + start, c_len_txt - s->c_len);
+		if (beg < 0)
 			return 0;	/* out of range */
-	}
 
-	for (i = beg; i != end; i += dx)
-	{
-		if (memcmp(str_txt + i, str_pat, len_pat) == 0)
+		offset = 0;
+		for (i = 0; i <= beg && offset + len_pat <= len_txt; i++)
+		{
+			if (memcmp(str_txt + offset, str_pat, len_pat) == 0)
+				matches += 1;
+			offset += _pg_mblen(str_txt + offset);
+		}
+
+		if (matches < nth)
+			return 0;
+
+		/* nth occurrence from right is (matches - nth + 1) from left */
+		nth = matches - nth + 1;
+		offset = 0;
+		for (i = 0; i <= beg && offset + len_pat <= len_txt; i++)
 		{
-			if (--nth == 0)
-				return i + 1;
+			if (memcmp(str_txt + offset, str_pat, len_pat) == 0)
+			{
+				if (--nth == 0)
+					return i + 1;
+			}
+			offset += _pg_mblen(str_txt + offset);
 		}
 	}
 
 	return 0;
 }
 
+/*
+ * UTF8 is self-synchronizing - any byte match of valid pattern starts
+ * on character boundary. So we can search on byte level, and only the
+ * start position and the found offset are translated between characters
+ * and bytes.
+ */
+static int
+ora_instr_mb(const char *str_txt, int len_txt, const OraSearcher *s,
+			 int start, int nth)
+{
+	int		beg;
+	int		pos;
+
+	if (GetDatabaseEncoding() != PG_UTF8)
+		return ora_instr_mb_walk(str_txt, len_txt, s, start, nth);
+
+	if (start > 0)
+	{
+		beg = mb_char_offset(str_txt, len_txt, start - 1);
+		if (beg < 0)
+			return 0;	/* out of range */
+
+		pos = search_forward(s, str_txt, len_txt, beg, nth);
+		if (pos < 0)
+			return 0;
+
+		return start + ora_mbstrlen_with_len(str_txt + beg, pos - beg);
+	}
+	else
+	{
+		beg = utf8_char_offset_from_end(str_txt, len_txt, -start);
+		if (beg < 0)
+			return 0;	/* out of range */
+
+		pos = search_backward(s, str_txt, len_txt, beg, nth);
+		if (pos < 0)
+			return 0;
+
+		return ora_mbstrlen_with_len(str_txt, pos) + 1;
+	}
+}
+
+static int
+ora_instr_searcher(text *txt, const OraSearcher *s, int start, int nth)
+{
+	int			len_txt;
+	const char *str_txt;
+	bool		mb_encode;
+	int			pos;
+
+	if (nth <= 0)
+		PARAMETER_ERROR("Four parameter isn't positive.");
+
+	mb_encode = pg_database_encoding_max_length() > 1;
+
+	str_txt = VARDATA_ANY(txt);
+	len_txt = VARSIZE_ANY_EXHDR(txt);
+
+	/* empty pattern is found on every position */
+	if (s->len == 0)
+	{
+		int		c_len_txt;
+
+		c_len_txt = mb_encode ? ora_mb_strlen1(txt) : len_txt;
+
+		if (start > 0)
+			return (start - 2 + nth <= c_len_txt) ? start - 1 + nth : 0;
+
+		pos = Min(c_len_txt + start, c_len_txt) - nth + 1;
+		return (pos >= 0) ? pos + 1 : 0;
+	}
+
+	/* Forward for multibyte strings */
+	if (mb_encode)
+		return ora_instr_mb(str_txt, len_txt, s, start, nth);
+
+	if (start > 0)
+		pos = search_forward(s, str_txt, len_txt, start - 1, nth);
+	else
+		pos = search_backward(s, str_txt, len_txt, len_txt + start, nth);
+
+	return pos >= 0 ? pos + 1 : 0;
+}
+
 
 /****************************************************************
  * PLVstr.normalize
@@ -296,14 +747,69 @@ ora_instr(text *txt, text *pattern, int start, int nth)
  *
  ****************************************************************/
 
+/*
+ * Returns length of prefix of printable ASCII chars (bytes greater than
+ * space and without high bit). These bytes are copied by normalize without
+ * any change. The bytes are checked in 16/32 bytes blocks with SSE2/AVX2
+ * signed compare (high bit bytes are negative), or in 8 bytes words.
+ */
+static int
+clean_run_len(const char *str, int len)
+{
+	const char *p = str;
+	const char *end = str + len;
+
+#if defined(__AVX2__)
+	const __m256i space = _mm256_set1_epi8(' ');
+
+	while (end - p >= 32)
+	{
+		__m256i		v = _mm256_loadu_si256((const __m256i *) p);
+
+		if (_mm256_movemask_epi8(_mm256_cmpgt_epi8(v, space)) != -1)
+			break;
+		p += 32;
+	}
+#elif defined(__SSE2__) || defined(_M_X64)
+	const __m128i space = _mm_set1_epi8(' ');
+
+	while (end - p >= 16)
+	{
+		__m128i		v = _mm_loadu_si128((const __m128i *) p);
+
+		if (_mm_movemask_epi8(_mm_cmpgt_epi8(v, space)) != 0xFFFF)
+			break;
+		p += 16;
+	}
+#else
+	while (end - p >= 8)
+	{
+		uint64		w;
+
+		memcpy(&w, p, 8);
+
+		/* some byte is less than 0x21 or has high bit */
+		if (((w - UINT64CONST(0x2121212121212121)) | w) &
+			UINT64CONST(0x8080808080808080))
+			break;
+		p += 8;
+	}
+#endif
+
+	while (p < end && (signed char) *p > ' ')
+		p += 1;
+
+	return p - str;
+}
+
 Datum
 plvstr_normalize(PG_FUNCTION_ARGS)
 {
 	text *str = PG_GETARG_TEXT_PP(0);
 	text *result;
 	char *aux, *aux_cur;
-	int i, l;
-	char c, *cur;
+	int l, run;
+	char *cur, *end;
 	bool write_spc = false;
 	bool ignore_stsp = true;
 	bool mb_encode;
@@ -312,68 +818,60 @@ plvstr_normalize(PG_FUNCTION_ARGS)
 	mb_encode = pg_database_encoding_max_length() > 1;
 
 	l = VARSIZE_ANY_EXHDR(str);
-	aux_cur = aux = palloc(l);
+	result = palloc(l + VARHDRSZ);
+	aux_cur = aux = VARDATA(result);
 
-	write_spc = false;
 	cur = VARDATA_ANY(str);
+	end = cur + l;
 
-	for (i = 0; i < l; i++)
+	while (cur < end)
 	{
-		switch ((c = *cur))
+		/* visible ASCII chars are copied as block */
+		run = clean_run_len(cur, end - cur);
+		if (run > 0)
+		{
+			if (write_spc)
+			{
+				*aux_cur++ = ' ';
+				write_spc = false;
+			}
+			memcpy(aux_cur, cur, run);
+			aux_cur += run;
+			cur += run;
+			ignore_stsp = false;
+			continue;
+		}
+
+		switch (*cur)
 		{
 			case '\t':
 			case '\n':
 			case '\r':
 			case ' ':
 				write_spc = ignore_stsp ? false : true;
+				cur += 1;
 				break;
 			default:
 				/* ignore all other unvisible chars */
-
-				if (mb_encode)
+				if (mb_encode && IS_HIGHBIT_SET(*cur))
 				{
 					sz = _pg_mblen(cur);
-					if (sz > 1 || (sz == 1 && c > 32))
+					if (write_spc)
 					{
-						int j;
-
-						if (write_spc)
-						{
-							*aux_cur++ = ' ';
-							write_spc = false;
-
-						}
-						for (j = 0; j < sz; j++)
-						{
-							*aux_cur++ = *cur++;
-						}
-						ignore_stsp = false;
-						i += sz - 1;
+						*aux_cur++ = ' ';
+						write_spc = false;
 					}
-					continue;
-
+					memcpy(aux_cur, cur, sz);
+					aux_cur += sz;
+					cur += sz;
+					ignore_stsp = false;
 				}
 				else
-					if (c > 32)
-					{
-						if (write_spc)
-						{
-							*aux_cur++ = ' ';
-							write_spc = false;
-						}
-						*aux_cur++ = c;
-						ignore_stsp = false;
-						continue;
-					}
-
+					cur += 1;
 		}
-		cur += 1;
 	}
 
-	l = aux_cur - aux;
-	result = palloc(l+VARHDRSZ);
-	SET_VARSIZE(result, l + VARHDRSZ);
-	memcpy(VARDATA(result), aux, l);
+	SET_VARSIZE(result, (aux_cur - aux) + VARHDRSZ);
 
 	PG_RETURN_TEXT_P(result);
 }
@@ -401,7 +899,9 @@ plvstr_instr2 (PG_FUNCTION_ARGS)
 	text *arg1 = PG_GETARG_TEXT_PP(0);
 	text *arg2 = PG_GETARG_TEXT_PP(1);
 
-	PG_RETURN_INT32(ora_instr(arg1, arg2, 1, 1));
+	PG_RETURN_INT32(ora_instr_searcher(arg1,
+									   get_cached_searcher(fcinfo, 0, arg2),
+									   1, 1));
 }
 
 Datum
@@ -411,7 +911,9 @@ plvstr_instr3 (PG_FUNCTION_ARGS)
 	text *arg2 = PG_GETARG_TEXT_PP(1);
 	int arg3 = PG_GETARG_INT32(2);
 
-	PG_RETURN_INT32(ora_instr(arg1, arg2, arg3, 1));
+	PG_RETURN_INT32(ora_instr_searcher(arg1,
+									   get_cached_searcher(fcinfo, 0, arg2),
+									   arg3, 1));
 }
 
 Datum
@@ -422,7 +924,9 @@ plvstr_instr4 (PG_FUNCTION_ARGS)
 	int arg3 = PG_GETARG_INT32(2);
 	int arg4 = PG_GETARG_INT32(3);
 
-	PG_RETURN_INT32(ora_instr(arg1, arg2, arg3, arg4));
+	PG_RETURN_INT32(ora_instr_searcher(arg1,
+									   get_cached_searcher(fcinfo, 0, arg2),
+									   arg3, arg4));
 }
 
 
@@ -558,23 +1062,37 @@ plvstr_rvrs(PG_FUNCTION_ARGS)
 	int new_len;
 	text *result;
 	char *data;
-	char *sizes = NULL;
-	int *positions = NULL;
 	bool mb_encode;
 
 	if (PG_ARGISNULL(0))
 		PG_RETURN_NULL();
 
-	str = PG_GETARG_TEXT_PP(0);
-
 	mb_encode = pg_database_encoding_max_length() > 1;
+	start = PG_ARGISNULL(1) ? 1 : PG_GETARG_INT32(1);
+
+	/*
+	 * When the end position is known, we don't need to fetch and
+	 * decompress whole toasted value.
+	 */
+	if (!PG_ARGISNULL(2) && start >= 0 && PG_GETARG_INT32(2) > 0)
+	{
+		Datum	value = PG_GETARG_DATUM(0);
+		int64	slice_len;
+
+		slice_len = (int64) PG_GETARG_INT32(2) * pg_database_encoding_max_length();
+		if (slice_len < toast_raw_datum_size(value) - VARHDRSZ)
+			str = DatumGetTextPSlice(value, 0, (int32) slice_len);
+		else
+			str = PG_GETARG_TEXT_PP(0);
+	}
+	else
+		str = PG_GETARG_TEXT_PP(0);
 
 	if (!mb_encode)
 		len = VARSIZE_ANY_EXHDR(str);
 	else
-		len = ora_mb_strlen(str, &sizes, &positions);
+		len = ora_mb_strlen1(str);
 
-	start = PG_ARGISNULL(1) ? 1 : PG_GETARG_INT32(1);
 	end = PG_ARGISNULL(2) ? (start < 0 ? -len : len) : PG_GETARG_INT32(2);
 
 	if ((start > end && start > 0) || (start < end && start < 0))
@@ -590,7 +1108,7 @@ plvstr_rvrs(PG_FUNCTION_ARGS)
 		end = new_start;
 	}
 
-	start = start != 0 ? start : 1;
+	start = start > 0 ? start : 1;
 	end = end < len ? end : len;
 
 	new_len = end - start + 1;
@@ -598,30 +1116,49 @@ plvstr_rvrs(PG_FUNCTION_ARGS)
 
 	if (mb_encode)
 	{
-		int max_size;
-		int cur_size;
-		char *p;
-		int j;
-		int fz_size;
+		const char *p = VARDATA_ANY(str);
+		const char *p_end = p + VARSIZE_ANY_EXHDR(str);
+		const char *range_end;
+		int			size = 0;
+
+		/*
+		 * The byte range of reversed characters is found by mb_char_offset,
+		 * and the output buffer has exactly its size. The range is read
+		 * forward and written from the end of buffer, ASCII chars byte by
+		 * byte, other chars by memcpy.
+		 */
+		if (new_len > 0)
+		{
+			p += mb_char_offset(p, p_end - p, start - 1);
+			size = mb_char_offset(p, p_end - p, new_len);
+			if (size < 0)
+				size = p_end - p;
+		}
 
-		fz_size = VARSIZE_ANY_EXHDR(str);
+		range_end = p + size;
 
-		if ((max_size = (new_len*pg_database_encoding_max_length())) > fz_size)
-			result = palloc(fz_size + VARHDRSZ);
-		else
-			result = palloc(max_size + VARHDRSZ);
-		data = (char*) VARDATA(result);
+		result = palloc(size + VARHDRSZ);
+		SET_VARSIZE(result, size + VARHDRSZ);
+		data = VARDATA(result) + size;
 
-		cur_size = 0;
-		p = VARDATA_ANY(str);
-		for (i = end - 1; i>= start - 1; i--)
+		while (p < range_end)
 		{
-			for (j=0; j<sizes[i]; j++)
-				*data++ = *(p+positions[i]+j);
-			cur_size += sizes[i];
+			int		run;
+			int		sz;
+
+			run = ascii_prefix_len(p, range_end - p);
+			for (i = 0; i < run; i++)
+				*--data = p[i];
+			p += run;
+
+			if (p < range_end)
+			{
+				sz = Min(_pg_mblen(p), range_end - p);
+				data -= sz;
+				memcpy(data, p, sz);
+				p += sz;
+			}
 		}
-		SET_VARSIZE(result, cur_size + VARHDRSZ);
-
 	}
 	else
 	{
@@ -664,7 +1201,8 @@ plvstr_lpart (PG_FUNCTION_ARGS)
 	bool all_if_notfound  = PG_GETARG_BOOL(4);
 	int loc;
 
-	loc = ora_instr(str, div, start, nth);
+	loc = ora_instr_searcher(str, get_cached_searcher(fcinfo, 0, div),
+							 start, nth);
 	if (loc == 0)
 	{
 		if (all_if_notfound)
@@ -703,7 +1241,8 @@ plvstr_rpart (PG_FUNCTION_ARGS)
 	bool all_if_notfound  = PG_GETARG_BOOL(4);
 	int loc;
 
-	loc = ora_instr(str, div, start, nth);
+	loc = ora_instr_searcher(str, get_cached_searcher(fcinfo, 0, div),
+							 start, nth);
 	if (loc == 0)
 	{
 		if (all_if_notfound)
@@ -847,13 +1386,17 @@ plvstr_rstrip (PG_FUNCTION_ARGS)
 Datum
 plvstr_left (PG_FUNCTION_ARGS)
 {
-	text *str = PG_GETARG_TEXT_P(0);
+	Datum str = PG_GETARG_DATUM(0);
 	int n = PG_GETARG_INT32(1);
 	if (n < 0)
-		n = ora_mb_strlen1(str) + n;
+	{
+		if (pg_database_encoding_max_length() > 1)
+			str = PointerGetDatum(DatumGetTextPP(str));
+		n = ora_datum_strlen(str) + n;
+	}
 	n = n < 0 ? 0 : n;
 
-	PG_RETURN_TEXT_P(ora_substr_text(str, 1, n));
+	PG_RETURN_TEXT_P(ora_substr(str, 1, n));
 }
 
 
@@ -873,13 +1416,17 @@ plvstr_left (PG_FUNCTION_ARGS)
 Datum
 plvstr_right (PG_FUNCTION_ARGS)
 {
-	text *str = PG_GETARG_TEXT_P(0);
+	Datum str = PG_GETARG_DATUM(0);
 	int n = PG_GETARG_INT32(1);
 	if (n < 0)
-		n = ora_mb_strlen1(str) + n;
+	{
+		if (pg_database_encoding_max_length() > 1)
+			str = PointerGetDatum(DatumGetTextPP(str));
+		n = ora_datum_strlen(str) + n;
+	}
 	n = (n < 0) ? 0 : n;
 
-	PG_RETURN_TEXT_P(ora_substr_text(str, -n, -1));
+	PG_RETURN_TEXT_P(ora_substr(str, -n, -1));
 }
 
 /****************************************************************
@@ -1282,6 +1829,8 @@ plvstr_betwn_c(PG_FUNCTION_ARGS)
 
 	int v_start;
 	int v_end;
+	OraSearcher *start_s;
+	OraSearcher *end_s;
 
 	if (PG_ARGISNULL(0) || PG_ARGISNULL(1) ||
 		PG_ARGISNULL(3) || PG_ARGISNULL(4) ||
@@ -1297,15 +1846,18 @@ plvstr_betwn_c(PG_FUNCTION_ARGS)
 	inclusive = PG_GETARG_BOOL(5);
 	gotoend = PG_GETARG_BOOL(6);
 
+	start_s = get_cached_searcher(fcinfo, 0, start_in);
+	end_s = get_cached_searcher(fcinfo, 1, end_in);
+
 	if (startnth_in == 0)
 	{
 		v_start = 1;
-		v_end = ora_instr(string_in, end_in, 1, endnth_in);
+		v_end = ora_instr_searcher(string_in, end_s, 1, endnth_in);
 	}
 	else
 	{
-		v_start = ora_instr(string_in, start_in, 1, startnth_in);
-		v_end = ora_instr(string_in, end_in, v_start + 1, endnth_in);
+		v_start = ora_instr_searcher(string_in, start_s, 1, startnth_in);
+		v_end = ora_instr_searcher(string_in, end_s, v_start + 1, endnth_in);
 	}
 
 	if (v_start == 0)
@@ -1314,12 +1866,12 @@ plvstr_betwn_c(PG_FUNCTION_ARGS)
 	if (!inclusive)
 	{
 		if (startnth_in > 0)
-			v_start += ora_mb_strlen1(start_in);
+			v_start += start_s->c_len;
 
 		v_end -= 1;
 	}
 	else
-		v_end += (ora_mb_strlen1(end_in) - 1);
+		v_end += (end_s->c_len - 1);
 
 	if (((v_start > v_end) && (v_end > 0)) ||
 		(v_end <= 0 && !gotoend))
@@ -67,32 +67,122 @@ set_c_subst(text *sc)
 	MemoryContextSwitchTo(oldctx);
 }
 
+/*
+ * Template is compiled to literal segments separated by substitution
+ * slots. Template and substitution keyword are usually same for all
+ * calls, so compiled template and output function of array's element
+ * type are cached in fn_extra.
+ */
+typedef struct
+{
+	char	   *template_str;		/* copy of template, key */
+	int			template_len;
+	char	   *subst_str;			/* copy of substitution keyword, key */
+	int			subst_len;
+	int			nslots;
+	int		   *seg_start;			/* nslots + 1 literal segments */
+	int		   *seg_len;
+	Oid			elemtype;			/* InvalidOid when proc is not valid */
+	int16		typlen;
+	bool		typbyval;
+	char		typalign;
+	Oid			typelem;
+	FmgrInfo	proc;
+} PlvsubstCache;
+
+static void
+compile_template(PlvsubstCache *cache, MemoryContext mcxt,
+				 const char *template_str, int template_len,
+				 const char *subst_str, int subst_len)
+{
+	int			pos = 0;
+	int			seg = 0;
+	int			nslots = 0;
+
+	if (cache->template_str != NULL)
+	{
+		pfree(cache->template_str);
+		pfree(cache->subst_str);
+		pfree(cache->seg_start);
+		pfree(cache->seg_len);
+		cache->template_str = NULL;
+	}
+
+	/* empty keyword matches everywhere, there are never enough parameters */
+	if (subst_len == 0 && template_len > 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_SYNTAX_ERROR),
+				 errmsg("too few parameters specified for template string")));
+
+	cache->seg_start = MemoryContextAlloc(mcxt, (template_len + 1) * sizeof(int));
+	cache->seg_len = MemoryContextAlloc(mcxt, (template_len + 1) * sizeof(int));
+
+	cache->seg_start[0] = 0;
+	while (pos < template_len)
+	{
+		if (subst_len <= template_len - pos &&
+			memcmp(template_str + pos, subst_str, subst_len) == 0)
+		{
+			cache->seg_len[nslots] = pos - seg;
+			pos += subst_len;
+			seg = pos;
+			cache->seg_start[++nslots] = seg;
+		}
+		else
+			pos += pg_mblen(template_str + pos);
+	}
+	cache->seg_len[nslots] = template_len - seg;
+	cache->nslots = nslots;
+
+	cache->template_str = MemoryContextAlloc(mcxt, template_len + 1);
+	memcpy(cache->template_str, template_str, template_len);
+	cache->template_len = template_len;
+
+	cache->subst_str = MemoryContextAlloc(mcxt, subst_len + 1);
+	memcpy(cache->subst_str, subst_str, subst_len);
+	cache->subst_len = subst_len;
+}
+
 static text*
 plvsubst_string(text *template_in, ArrayType *vals_in, text *c_subst, FunctionCallInfo fcinfo)
 {
+	PlvsubstCache  *cache = (PlvsubstCache *) fcinfo->flinfo->fn_extra;
 	ArrayType	   *v = vals_in;
 	int				nitems,
 				   *dims,
 					ndims;
 	char		   *p;
-	int16			typlen;
-	bool			typbyval;
-	char			typalign;
-	char			typdelim;
-	Oid				typelem;
-	Oid				typiofunc;
-	FmgrInfo		proc;
-	int				i = 0, items = 0;
-	StringInfo		sinfo;
+	int				i;
+	StringInfoData	sinfo;
 	const char	   *template_str;
 	int				template_len;
-	char		   *sizes;
-	int			   *positions;
-	int				subst_mb_len;
+	const char	   *subst_str;
 	int				subst_len;
 	const bits8	   *bitmap;
 	int				bitmask;
 
+	if (cache == NULL)
+	{
+		cache = MemoryContextAllocZero(fcinfo->flinfo->fn_mcxt,
+									   sizeof(PlvsubstCache));
+		cache->elemtype = InvalidOid;
+		fcinfo->flinfo->fn_extra = cache;
+	}
+
+	template_str = VARDATA_ANY(template_in);
+	template_len = VARSIZE_ANY_EXHDR(template_in);
+	subst_str = VARDATA_ANY(c_subst);
+	subst_len = VARSIZE_ANY_EXHDR(c_subst);
+
+	if (cache->template_str == NULL ||
+		cache->template_len != template_len ||
+		cache->subst_len != subst_len ||
+		memcmp(cache->template_str, template_str, template_len) != 0 ||
+		memcmp(cache->subst_str, subst_str, subst_len) != 0)
+		compile_template(cache, fcinfo->flinfo->fn_mcxt,
+						 template_str, template_len,
+						 subst_str, subst_len);
+
 	if (v != NULL && (ndims = ARR_NDIM(v)) > 0)
 	{
 		if (ndims != 1)
@@ -105,11 +195,19 @@ plvsubst_string(text *template_in, ArrayType *vals_in, text *c_subst, FunctionCa
 		dims = ARR_DIMS(v);
 		nitems = ArrayGetNItems(ndims, dims);
 		bitmap = ARR_NULLBITMAP(v);
-		get_type_io_data(ARR_ELEMTYPE(v), IOFunc_output,
-							&typlen, &typbyval,
-							&typalign, &typdelim,
-							&typelem, &typiofunc);
-		fmgr_info_cxt(typiofunc, &proc, fcinfo->flinfo->fn_mcxt);
+
+		if (cache->elemtype != ARR_ELEMTYPE(v))
+		{
+			char		typdelim;
+			Oid			typiofunc;
+
+			get_type_io_data(ARR_ELEMTYPE(v), IOFunc_output,
+								&cache->typlen, &cache->typbyval,
+								&cache->typalign, &typdelim,
+								&cache->typelem, &typiofunc);
+			fmgr_info_cxt(typiofunc, &cache->proc, fcinfo->flinfo->fn_mcxt);
+			cache->elemtype = ARR_ELEMTYPE(v);
+		}
 	}
 	else
 	{
@@ -118,62 +216,59 @@ plvsubst_string(text *template_in, ArrayType *vals_in, text *c_subst, FunctionCa
 		bitmap = NULL;
 	}
 
-	template_str = VARDATA(template_in);
-	template_len = ora_mb_strlen(template_in, &sizes, &positions);
-	subst_mb_len = ora_mb_strlen1(c_subst);
-	subst_len = VARSIZE_ANY_EXHDR(c_subst);
-	sinfo = makeStringInfo();
+	if (cache->nslots > nitems)
+		ereport(ERROR,
+				(errcode(ERRCODE_SYNTAX_ERROR),
+				 errmsg("too few parameters specified for template string")));
+
+	/* the result is built directly as text value */
+	initStringInfo(&sinfo);
+	appendStringInfoSpaces(&sinfo, VARHDRSZ);
+
+	appendBinaryStringInfo(&sinfo, cache->template_str, cache->seg_len[0]);
 
 	bitmask = 1;
-	for (i = 0; i < template_len; i++)
+	for (i = 0; i < cache->nslots; i++)
 	{
-		if (strncmp(&template_str[positions[i]], VARDATA(c_subst), subst_len) == 0)
+		if (bitmap && (*bitmap & bitmask) == 0)
+			appendStringInfoString(&sinfo, "NULL");
+		else
 		{
-			Datum    itemvalue;
-			char     *value;
+			Datum	itemvalue;
+			char   *value;
+
+			itemvalue = fetch_att(p, cache->typbyval, cache->typlen);
+			value = DatumGetCString(FunctionCall3(&cache->proc,
+						itemvalue,
+						ObjectIdGetDatum(cache->typelem),
+						Int32GetDatum(-1)));
+
+			p = att_addlength_pointer(p, cache->typlen, p);
+			p = (char *) att_align_nominal(p, cache->typalign);
 
-			if (items++ < nitems)
+			appendStringInfoString(&sinfo, value);
+			pfree(value);
+		}
+
+		if (bitmap)
+		{
+			bitmask <<= 1;
+			if (bitmask == 0x100)
 			{
-				if (bitmap && (*bitmap & bitmask) == 0)
-					value = pstrdup("NULL");
-				else
-				{
-					itemvalue = fetch_att(p, typbyval, typlen);
-					value = DatumGetCString(FunctionCall3(&proc,
-								itemvalue,
-								ObjectIdGetDatum(typelem),
-								Int32GetDatum(-1)));
-
-					p = att_addlength_pointer(p, typlen, p);
-					p = (char *) att_align_nominal(p, typalign);
-				}
-				appendStringInfoString(sinfo, value);
-				pfree(value);
-
-				if (bitmap)
-				{
-					bitmask <<= 1;
-					if (bitmask == 0x100)
-					{
-						bitmap++;
-						bitmask = 1;
-					}
-				}
+				bitmap++;
+				bitmask = 1;
 			}
-			else
-				ereport(ERROR,
-						(errcode(ERRCODE_SYNTAX_ERROR),
-						 errmsg("too few parameters specified for template string")));
-
-			i += subst_mb_len - 1;
 		}
-		else
-			appendBinaryStringInfo(sinfo, &template_str[positions[i]], sizes[i]);
+
+		appendBinaryStringInfo(&sinfo,
+							   cache->template_str + cache->seg_start[i + 1],
+							   cache->seg_len[i + 1]);
 	}
 
-	return cstring_to_text(sinfo->data);
-}
+	SET_VARSIZE(sinfo.data, sinfo.len);
 
+	return (text *) sinfo.data;
+}
 
 Datum
 plvsubst_string_array(PG_FUNCTION_ARGS)
@@ -53,11 +53,60 @@ CREATE OR REPLACE FUNCTION checkIntUnpaddedCallStack() returns text  as $$
         END;
 $$ LANGUAGE plpgsql;
 
+/*
+ * Test for dbms_utility.call_stack() and dbms_utility.call_stack_depth().
+ * Only PL/pgSQL frames are returned, depth 1 is the caller.
+ */
+
+CREATE OR REPLACE FUNCTION checkCallStackInner() returns text  as $$
+        BEGIN
+             RETURN (SELECT string_agg(depth || ',' || coalesce(func::regprocedure::text, 'null') || ',' || (lineno > 0), ';' ORDER BY depth)
+                       FROM dbms_utility.call_stack()) || ' ' || dbms_utility.call_stack_depth();
+        END;
+$$ LANGUAGE plpgsql;
+
+CREATE OR REPLACE FUNCTION checkCallStack() returns text  as $$
+        BEGIN
+             RETURN checkCallStackInner();
+        END;
+$$ LANGUAGE plpgsql;
+
+/*
+ * Both paths of call_stack() and call_stack_depth() have to return same
+ * result. The error context is parsed when orafce.plpgsql_call_stack is off,
+ * the frames are read directly when it is on.
+ */
+CREATE OR REPLACE FUNCTION checkCallStackPaths() returns text  as $$
+        DECLARE
+             by_context text;
+             by_plugin text;
+        BEGIN
+             PERFORM set_config('orafce.plpgsql_call_stack', 'off', true);
+             by_context := checkCallStack();
+             PERFORM set_config('orafce.plpgsql_call_stack', 'on', true);
+             by_plugin := checkCallStack();
+             RETURN by_context || ' | ' || by_plugin || ' | ' || (by_context = by_plugin);
+        END;
+$$ LANGUAGE plpgsql;
+
 select * from checkHexCallStack();
 select * from checkIntCallStack();
 select * from checkIntUnpaddedCallStack();
+select * from checkCallStack();
+select * from checkCallStackPaths();
+SET orafce.plpgsql_call_stack = on;
+select * from checkCallStack();
+DO $$
+BEGIN
+  RAISE NOTICE '%', (SELECT string_agg(coalesce(func::text, 'null'), ',') FROM dbms_utility.call_stack());
+END;
+$$;
+RESET orafce.plpgsql_call_stack;
 
 DROP FUNCTION checkHexCallStack();
 DROP FUNCTION checkIntCallStack();
 DROP FUNCTION checkIntUnpaddedCallStack();
+DROP FUNCTION checkCallStackPaths();
+DROP FUNCTION checkCallStack();
+DROP FUNCTION checkCallStackInner();
 
@@ -19,3 +19,11 @@ SELECT set_nls_sort('en_US.utf8');
 SELECT * FROM test_sort ORDER BY NLSSORT(name);
 INSERT INTO test_sort VALUES(NULL);
 SELECT * FROM test_sort ORDER BY NLSSORT(name);
+DO $$
+BEGIN
+  PERFORM nlssort('red', 'xx-x-icu');
+  RAISE NOTICE 'unknown locale accepted';
+EXCEPTION WHEN OTHERS THEN
+  RAISE NOTICE 'unknown locale rejected';
+END;
+$$;
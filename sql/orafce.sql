@@ -182,6 +182,7 @@ select plvsubst.string('My name is %s %s.', 'Pavel|Stěhule','|');
 select plvsubst.string('My name is %s.', 'Stěhule');
 select plvsubst.string('My name is %s.', '');
 select plvsubst.string('My name is empty.', '');
+select plvsubst.string(t, ARRAY[a, b]) from (values('%s-%s', 'a', 'b'), ('%s-%s', 'c', NULL), ('[%s]', 'd', 'e')) v(t, a, b);
 
 select round(to_date ('22-AUG-03', 'DD-MON-YY'),'YEAR')  =  to_date ('01-JAN-04', 'DD-MON-YY');
 select round(to_date ('22-AUG-03', 'DD-MON-YY'),'Q')  =  to_date ('01-OCT-03', 'DD-MON-YY');
@@ -201,6 +202,18 @@ select trunc(TIMESTAMP WITH TIME ZONE '2004-10-19 10:23:54+02','DDD') = '2004-10
 select trunc(TIMESTAMP WITH TIME ZONE '2004-10-19 10:23:54+02','DAY') = '2004-10-17 00:00:00-07';
 select trunc(TIMESTAMP WITH TIME ZONE '2004-10-19 10:23:54+02','HH') = '2004-10-19 01:00:00-07';
 select trunc(TIMESTAMP WITH TIME ZONE '2004-10-19 10:23:54+02','MI') = '2004-10-19 01:23:00-07';
+select trunc(TIMESTAMP '1999-12-31 23:59:59.5','DD') = '1999-12-31 00:00:00';
+select trunc(TIMESTAMP '1999-12-31 23:59:59.5','HH') = '1999-12-31 23:00:00';
+select trunc(TIMESTAMP '1999-12-31 23:59:59.5','MI') = '1999-12-31 23:59:00';
+select trunc(TIMESTAMP '2016-02-29 10:23:54','MM') = '2016-02-01 00:00:00';
+select trunc(TIMESTAMP '2016-02-29 10:23:54','YYYY') = '2016-01-01 00:00:00';
+select trunc(TIMESTAMP '2016-01-01 10:23:54','IW') = '2015-12-28 00:00:00';
+select trunc(TIMESTAMP '0044-03-15 12:00:00 BC','YYYY') = '0044-01-01 00:00:00 BC';
+select count(*) = 4 from (values('MM', '2016-02-01'::timestamp), ('yyyy', '2016-01-01'), ('MM', '2016-02-01'), ('hh', '2016-02-29 10:00')) v(f, r) where trunc(TIMESTAMP '2016-02-29 10:23:54', f) = r;
+select abs(extract(epoch from oracle.sysdate() - (statement_timestamp() at time zone 'GMT'))) <= 0.5;
+set orafce.timezone = 'Europe/Prague';
+select abs(extract(epoch from oracle.sysdate() - (statement_timestamp() at time zone 'Europe/Prague'))) <= 0.5;
+reset orafce.timezone;
 
 select next_day(to_date('01-Aug-03', 'DD-MON-YY'), 'TUESDAY')  =  to_date ('05-Aug-03', 'DD-MON-YY');
 select next_day(to_date('06-Aug-03', 'DD-MON-YY'), 'WEDNESDAY') =  to_date ('13-Aug-03', 'DD-MON-YY');
@@ -233,12 +246,22 @@ select 0 = instr('abcabcabc', 'abca', -10);
 select 1 = instr('abcabcabc', 'abca', 1, 1);
 select 4 = instr('abcabcabc', 'abca', 1, 2);
 select 0 = instr('abcabcabc', 'abca', 1, 3);
+select 3 = instr('aaaaaaaaaa', 'aaaaa', 1, 3);
+select 2 = instr('abcdefgabcdefg', 'bcdefg', -1, 2);
+select 0 = instr('abcdefgabcdefg', 'bcdefg', -14, 1);
+select 19 = instr('příliš žluťoučký kůň', 'ůň');
+select 13 = instr('příliš žluťoučký kůň', 'u', 1, 2);
+select 18 = instr('příliš žluťoučký kůň', 'k', -1);
+select 15 = instr('příliš žluťoučký kůň', 'k', -4);
 select oracle.substr('This is a test', 6, 2) = 'is';
 select oracle.substr('This is a test', 6) =  'is a test';
 select oracle.substr('TechOnTheNet', 1, 4) =  'Tech';
 select oracle.substr('TechOnTheNet', -3, 3) =  'Net';
 select oracle.substr('TechOnTheNet', -6, 3) =  'The';
 select oracle.substr('TechOnTheNet', -8, 2) =  'On';
+select oracle.substr('příliš žluťoučký kůň', -3, 2) = 'ků';
+select oracle.substr('příliš žluťoučký kůň', -25) = '';
+select oracle.substr(repeat('ž', 10000) || 'konec', -5) = 'konec';
 select oracle.substr('TechOnTheNet', -8, 0) =  '';
 select oracle.substr('TechOnTheNet', -8, -1) =  '';
 select oracle.substr(1234567,3.6::smallint)='4567';
@@ -293,6 +316,12 @@ select nvl2(NULL, 2, 3);
 select lnnvl(true);
 select lnnvl(false);
 select lnnvl(NULL);
+create table nvl_test(a int, b int, c bool);
+insert into nvl_test values(1, 2, true), (NULL, 2, false), (NULL, NULL, NULL);
+-- nvl, nvl2 and lnnvl are inlined by planner
+explain (verbose, costs off) select nvl(a, b), nvl2(a, b, 0), lnnvl(c) from nvl_test;
+select nvl(a, b), nvl2(a, b, 0), lnnvl(c) from nvl_test;
+drop table nvl_test;
 select decode(1, 1, 100, 2, 200);
 select decode(2, 1, 100, 2, 200);
 select decode(3, 1, 100, 2, 200);
@@ -473,10 +502,22 @@ select decode(1, 1, 'one', 2, 'two', 1, 'one-again') = 'one';
 -- 1) succeed and return 'result-1'
 select decode('2012-01-01', '2012-01-01'::date,'result-1','2012-01-02', 'result-2');
 select decode('2012-01-01', '2012-01-01', 'result-1', '2012-02-01'::date, 'result-2');
+select decode(7, 1, 'a', 2, 'b', 3, 'c', 4, 'd', 5, 'e', 6, 'f', 7, 'g', 8, 'h', 7, 'g-again', 'none') = 'g';
+select decode(10, 1, 'a', 2, 'b', 3, 'c', 4, 'd', 5, 'e', 6, 'f', 7, 'g', 8, 'h', 7, 'g-again', 'none') = 'none';
+select decode(10, 1, 'a', 2, 'b', 3, 'c', 4, 'd', 5, 'e', 6, 'f', 7, 'g', 8, 'h', 7, 'g-again') is null;
+select string_agg(decode(i, 1, 'a', 2, 'b', 3, 'c', 4, 'd', 5, 'e', 6, 'f', 7, 'g', 8, 'h', 7, 'g-again', 'none'), ',' order by i) = 'none,a,b,c,d,e,f,g,h,none' from generate_series(0, 9) g(i);
+select string_agg(decode(i, null, 'a', 2, 'b', 3, 'c', 4, 'd', 5, 'e', 6, 'f', 7, 'g', 8, 'h', 9, 'i', 'none'), ',' order by i) = 'none,none,b,c' from generate_series(0, 3) g(i);
+select string_agg(decode(3, i, 'hit', 10, 'b', 11, 'c', 12, 'd', 13, 'e', 14, 'f', 15, 'g', 16, 'h', 'none'), ',' order by i) = 'none,none,hit,none' from generate_series(1, 4) g(i);
+do $$declare r text := ''; begin for i in 1..4 loop r := r || decode(3, i, 'hit', 10, 'b', 11, 'c', 12, 'd', 13, 'e', 14, 'f', 15, 'g', 16, 'h', 'none') || ','; end loop; raise notice '%', r; end$$;
 
 select PLVstr.rvrs ('Jumping Jack Flash') ='hsalF kcaJ gnipmuJ';
+select PLVstr.normalize(E'  Jumping\t\tJack \r\n Flash  ') = 'Jumping Jack Flash';
+select PLVstr.normalize(E' Příliš\x01 žluťoučký\n\n kůň úpěl ďábelské ódy ') = 'Příliš žluťoučký kůň úpěl ďábelské ódy';
 select PLVstr.rvrs ('Jumping Jack Flash', 9) = 'hsalF kcaJ';
 select PLVstr.rvrs ('Jumping Jack Flash', 4, 6) = 'nip';
+select PLVstr.rvrs ('kůň a žluťoučký', 5) = 'ýkčuoťulž a';
+select PLVstr.rvrs ('kůň a žluťoučký', 1, 3) = 'ňůk';
+select PLVstr.rvrs ('abc', -1, -10) = 'cba';
 select PLVstr.rvrs (NULL, 10, 20);
 select PLVstr.rvrs ('alphabet', -2, -5);
 select PLVstr.rvrs ('alphabet', -2);
@@ -486,8 +527,15 @@ select PLVstr.lstrip ('*val1|val2|val3|*', '*') = 'val1|val2|val3|*';
 select PLVstr.lstrip (',,,val1,val2,val3,', ',', 3)= 'val1,val2,val3,';
 select PLVstr.lstrip ('WHERE WHITE = ''FRONT'' AND COMP# = 1500', 'WHERE ') = 'WHITE = ''FRONT'' AND COMP# = 1500';
 select plvstr.left('Příliš žluťoučký kůň',4) = pg_catalog.substr('Příl', 1, 4);
+select plvstr.left('příliš žluťoučký kůň úpěl ďábelské ódy', -4) = 'příliš žluťoučký kůň úpěl ďábelské';
+select plvstr.right('příliš žluťoučký kůň úpěl ďábelské ódy', -35) = 'ódy';
 
 select pos,token from plvlex.tokens('select * from a.b.c join d ON x=y', true, true);
+select pos, token, class, separator, mod from plvlex.tokens('x || ''a'' || $q$b$q$', true, false);
+select pos, token, class, mod from plvlex.tokens('a::int /* b', true, false);
+select plvlex.fingerprint('SELECT a, b FROM t WHERE x = 10');
+select plvlex.fingerprint('SELECT a, b FROM t WHERE x = 10') = plvlex.fingerprint('select A,b  from "t" where x=''abc'' -- comment');
+select * from plvlex.fingerprint('SELECT a.b, f(1, ''x'') FROM "T" t /* c */ WHERE x::int = $1', true);
 
 SET lc_numeric TO 'C';
 select to_char(22);
@@ -514,6 +562,9 @@ SELECT to_number(1210::smallint, 9999::smallint);
 SELECT to_number(1210::int, 9999::int);
 SELECT to_number(1210::bigint, 9999::bigint);
 SELECT to_number(1210.73::numeric, 9999.99::numeric);
+SELECT to_number('1.234.567,89', '9G999G999D99', 'NLS_NUMERIC_CHARACTERS = '',.''') = 1234567.89;
+SELECT to_number('123,45', '999D99', 'nls_numeric_characters='',.''') = 123.45;
+SELECT to_number('1', '9', 'NLS_CURRENCY = ''$''');
 
 SELECT to_date('2009-01-02');
 
@@ -589,6 +640,15 @@ SELECT dump(10.23::numeric) ~ E'^Typ=1700 Len=(\\d+): \\d+(,\\d+)*$' AS t;
 SELECT dump('2008-10-10'::date) ~ E'^Typ=1082 Len=4: \\d+(,\\d+){3}$' AS t;
 SELECT dump('2008-10-10'::timestamp) ~ E'^Typ=1114 Len=8: \\d+(,\\d+){7}$' AS t;
 SELECT dump('2009-10-10'::timestamp) ~ E'^Typ=1114 Len=8: \\d+(,\\d+){7}$' AS t;
+SELECT dump('Yellow dog'::text, 16) ~ E'^Typ=25 Len=(\\d+): [0-9a-f]+(,[0-9a-f]+)*$' AS t;
+SELECT dump('Yellow dog'::text, 16, 1, 3) = 'Typ=25 Len=10: 59,65,6c' AS t;
+SELECT dump('Yellow dog'::text, 8, 8, 0) = 'Typ=25 Len=10: 144,157,147' AS t;
+SELECT dump('Yellow dog'::text, 17, -3, 2) = 'Typ=25 Len=10: d,o' AS t;
+SELECT dump('Yellow dog'::text, 10, 20, 2) = 'Typ=25 Len=10: ' AS t;
+SELECT dump(10::int4, 10, 1, 2) ~ E'^Typ=23 Len=4: \\d+,\\d+$' AS t;
+SELECT dump('Yellow dog'::text, 16) = 'Typ=25 Len=10: 59,65,6c,6c,6f,77,20,64,6f,67' AS t;
+SELECT dump('Yellow dog'::text, 16, 1, 0) = dump('Yellow dog'::text, 16) AS t;
+SELECT dump(repeat('x', 100000), 17) = 'Typ=25 Len=100000: ' || rtrim(repeat('x,', 100000), ',') AS t;
 
 -- Tests for to_multi_byte
 SELECT to_multi_byte('123$test');
@@ -602,6 +662,7 @@ SELECT to_single_byte('１２３＄ｔｅｓｔ');
 -- Check internal representation difference
 SELECT octet_length('ａｂｃ');
 SELECT octet_length(to_single_byte('ａｂｃ'));
+SELECT to_single_byte('abc ａｂｃ žluť') = 'abc abc žluť';
 
 -- Tests for round(TIMESTAMP WITH TIME ZONE)
 select round(TIMESTAMP WITH TIME ZONE'12/08/1990 05:35:25','YEAR') = '1991-01-01 00:00:00';
@@ -632,6 +693,16 @@ select to_date('Jan-08-99');
 select to_date('19990108');
 select to_date('990108');
 select to_date('J2451187');
+set orafce.nls_date_format='DD.MM.YYYY';
+select to_date('31.12.1999') = '1999-12-31 00:00:00';
+select to_date('29.02.2016') = '2016-02-29 00:00:00';
+select to_date('1.2.2016') = '2016-02-01 00:00:00';
+set orafce.nls_date_format='YYYY-MM-DD HH24:MI:SS';
+select to_date('2014-07-02 10:08:55') = '2014-07-02 10:08:55';
+select to_date('2014-07-02 10:08:55+05:30') = '2014-07-02 10:08:55';
+set orafce.nls_date_format='YYYYMMDD';
+select to_date('20090102') = '2009-01-02 00:00:00';
+reset orafce.nls_date_format;
 set orafce.nls_date_format='YY-MonDD HH24:MI:SS';
 select to_date('14-Jan08 11:44:49+05:30');
 set orafce.nls_date_format='YY-DDMon HH24:MI:SS';
@@ -863,6 +934,9 @@ SELECT '|' || oracle.lpad('あbcd'::varchar2(5), 10, 'xい'::nvarchar2(5)) || '|
 SELECT '|' || oracle.lpad('あbcd'::nvarchar2(5), 10, 'xい'::text) || '|';
 SELECT '|' || oracle.lpad('あbcd'::nvarchar2(5), 10, 'xい'::varchar2(5)) || '|';
 SELECT '|' || oracle.lpad('あbcd'::nvarchar2(5), 10, 'xい'::nvarchar2(5)) || '|';
+SELECT oracle.lpad('abc'::text, 10, 'xy'::text) = 'xyxyxyxabc';
+SELECT oracle.lpad('42'::text, 6, '0'::text) = '000042';
+SELECT oracle.lpad('abcdef'::text, 3, 'xy'::text) = 'abc';
 
 --
 -- test RPAD family of functions
@@ -910,6 +984,8 @@ SELECT '|' || oracle.rpad('あbcd'::varchar2(5), 10, 'xい'::nvarchar2(5)) || '|
 SELECT '|' || oracle.rpad('あbcd'::nvarchar2(5), 10, 'xい'::text) || '|';
 SELECT '|' || oracle.rpad('あbcd'::nvarchar2(5), 10, 'xい'::varchar2(5)) || '|';
 SELECT '|' || oracle.rpad('あbcd'::nvarchar2(5), 10, 'xい'::nvarchar2(5)) || '|';
+SELECT oracle.rpad('abc'::text, 10, 'xy'::text) = 'abcxyxyxyx';
+SELECT oracle.rpad('abc'::text, 6) = 'abc   ';
 
 --
 -- test TRIM family of functions
@@ -974,6 +1050,32 @@ SELECT plvdate.bizdays_between('2016-02-21','2016-02-27');
 SELECT plvdate.include_start(false);
 SELECT plvdate.bizdays_between('2016-02-24','2016-02-26');
 SELECT plvdate.bizdays_between('2016-02-21','2016-02-27');
+SELECT plvdate.include_start(true);
+SELECT plvdate.default_holidays('czech');
+SELECT plvdate.bizdays_between('2016-01-01','2016-12-31');
+SELECT plvdate.bizdays_between('2010-01-01','2019-12-31');
+SELECT plvdate.add_bizdays('2016-12-22', 3) = '2016-12-28';
+SELECT plvdate.add_bizdays('2016-03-29', -2) = '2016-03-23';
+SELECT plvdate.isbizday('2016-03-28'), plvdate.isbizday('2016-03-29');
+SELECT plvdate.isbizday('1850-03-16') = false;
+SELECT plvdate.isbizday('1850-03-18');
+SELECT plvdate.next_bizday('2016-12-23') = '2016-12-27';
+SELECT plvdate.prev_bizday('2016-03-29') = '2016-03-24';
+SELECT plvdate.nearest_bizday('2016-03-26') = '2016-03-24';
+INSERT INTO plvdate.calendar VALUES('test', '{Saturday,Sunday}', true, true);
+INSERT INTO plvdate.calendar_holiday VALUES('test', 1, 1), ('test', 5, 1), ('test', 12, 25);
+INSERT INTO plvdate.calendar_feast VALUES('test', 60);
+INSERT INTO plvdate.calendar_exception VALUES('test', '2017-11-16');
+SELECT plvdate.bizdays_between('2017-01-01','2017-12-31','test') = 254;
+SELECT plvdate.isbizday('2017-06-15','test') = false;
+SELECT plvdate.next_bizday('2017-06-14','test') = '2017-06-16';
+SELECT plvdate.prev_bizday('2017-04-18','test') = '2017-04-13';
+SELECT plvdate.add_bizdays('2017-12-22', 1, 'test') = '2017-12-26';
+SELECT plvdate.nearest_bizday('2017-11-18','test') = '2017-11-17';
+INSERT INTO plvdate.calendar_holiday VALUES('test', 6, 16);
+SELECT plvdate.next_bizday('2017-06-14','test') = '2017-06-19';
+DELETE FROM plvdate.calendar WHERE name = 'test';
+SELECT plvdate.isbizday('2017-06-15','test');
 
 SELECT oracle.round(1.234::double precision, 2), oracle.trunc(1.234::double precision, 2);
 SELECT oracle.round(1.234::float, 2), oracle.trunc(1.234::float, 2);
@@ -37,15 +37,6 @@ static orafce_lexnode *__node;
     __node)
 
 
-extern int yylex(void);      /* defined as fdate_yylex in fdatescan.l */
-
-static char *scanbuf;
-static int	scanbuflen;
-
-void orafce_sql_yyerror(List **result, const char *message);
-
-
-#define YYLTYPE		int
 #define YYMALLOC	malloc	/* XXX: should use palloc? */
 #define YYFREE		free	/* XXX: should use pfree? */
 
@@ -54,12 +45,28 @@ void orafce_sql_yyerror(List **result, const char *message);
 %code requires {
 
 #include "nodes/pg_list.h"
+#include "plvlex.h"
+
+#define YYLTYPE		int
+
+}
+
+%code {
+
+extern int orafce_sql_yylex(YYSTYPE *lvalp, YYLTYPE *llocp,
+							orafce_sql_yyscan_t yyscanner);
+extern void orafce_sql_yyerror(YYLTYPE *llocp, List **result,
+							   orafce_sql_yyscan_t yyscanner,
+							   const char *message);
 
 }
 
+%define api.pure
 %name-prefix="orafce_sql_yy" 
 %locations
 %parse-param {List **result}
+%parse-param {orafce_sql_yyscan_t yyscanner}
+%lex-param {orafce_sql_yyscan_t yyscanner}
 
 %union
 {
@@ -31,17 +31,197 @@
 #include "builtins.h"
 
 #include "utils/elog.h"
+#include "utils/guc.h"
+#include "utils/hsearch.h"
+#include "utils/inval.h"
+#include "utils/syscache.h"
+#include "utils/tuplestore.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+
+#if PG_VERSION_NUM >= 90500
+
+#define ORAFCE_PLPGSQL_PLUGIN
+#include "plpgsql.h"
+
+#endif
 
 PG_FUNCTION_INFO_V1(dbms_utility_format_call_stack0);
 PG_FUNCTION_INFO_V1(dbms_utility_format_call_stack1);
+PG_FUNCTION_INFO_V1(dbms_utility_call_stack_depth);
+PG_FUNCTION_INFO_V1(dbms_utility_call_stack);
 
-static char*
-dbms_utility_format_call_stack(char mode)
+/*
+ * One line of error context. PL/pgSQL frames has plpgsql flag, fnoid is
+ * valid only when the function signature was resolved.
+ */
+typedef struct
+{
+	bool		plpgsql;
+	Oid			fnoid;
+	char	   *line;
+	char	   *oname;
+} CallStackFrame;
+
+typedef void (*ContextCallbackFunc) (void *arg);
+
+/*
+ * When orafce.plpgsql_call_stack is on, an empty PL/pgSQL plugin is
+ * installed to the "PLpgSQL_plugin" rendezvous variable (only when no
+ * other plugin is there). PL/pgSQL stores address of its error context
+ * callback to the plugin structure, and with this address the PL/pgSQL
+ * frames (and their execution states) can be found on error_context_stack
+ * directly, without errstart and formatting of context. The plugin has no
+ * callbacks, so it doesn't slow down PL/pgSQL.
+ */
+bool orafce_plpgsql_call_stack = false;
+
+#ifdef ORAFCE_PLPGSQL_PLUGIN
+
+static PLpgSQL_plugin orafce_plpgsql_plugin;
+static PLpgSQL_plugin **plpgsql_plugin_ptr = NULL;
+
+#endif
+
+void
+assign_plpgsql_call_stack(bool newval, void *extra)
+{
+
+#ifdef ORAFCE_PLPGSQL_PLUGIN
+
+	if (plpgsql_plugin_ptr == NULL)
+		plpgsql_plugin_ptr = (PLpgSQL_plugin **) find_rendezvous_variable("PLpgSQL_plugin");
+
+	if (newval)
+	{
+		/* don't replace a plugin loaded before */
+		if (*plpgsql_plugin_ptr == NULL)
+			*plpgsql_plugin_ptr = &orafce_plpgsql_plugin;
+	}
+	else if (*plpgsql_plugin_ptr == &orafce_plpgsql_plugin)
+		*plpgsql_plugin_ptr = NULL;
+
+#endif
+
+}
+
+/*
+ * Returns PL/pgSQL error context callback, or NULL when it is not used
+ * (orafce.plpgsql_call_stack is off), when it is not known yet (no
+ * PL/pgSQL function was started after plugin installation) or when it
+ * cannot be known.
+ */
+static ContextCallbackFunc
+get_plpgsql_error_callback(void)
+{
+
+#ifdef ORAFCE_PLPGSQL_PLUGIN
+
+	if (orafce_plpgsql_call_stack &&
+		plpgsql_plugin_ptr != NULL && *plpgsql_plugin_ptr != NULL)
+		return (*plpgsql_plugin_ptr)->error_callback;
+
+#endif
+
+	return NULL;
+}
+
+/*
+ * Signatures in the context are resolved by regprocedurein, that is too
+ * expensive for functions called often. The result is cached per signature,
+ * the cache is reset when pg_proc or search_path are changed.
+ */
+#define FNOID_CACHE_KEYSIZE		(NAMEDATALEN * 4)
+
+typedef struct
+{
+	char		signature[FNOID_CACHE_KEYSIZE];
+	Oid			fnoid;
+} FnoidCacheEntry;
+
+static HTAB *fnoid_cache = NULL;
+static char *fnoid_cache_search_path = NULL;
+static bool fnoid_cache_callback_registered = false;
+
+static void
+fnoid_cache_callback(Datum arg, int cacheid, uint32 hashvalue)
+{
+	if (fnoid_cache)
+	{
+		hash_destroy(fnoid_cache);
+		fnoid_cache = NULL;
+	}
+}
+
+static Oid
+get_fnoid(char *signature)
+{
+	const char *search_path;
+	FnoidCacheEntry *entry;
+	Oid			fnoid;
+
+	if (strlen(signature) >= FNOID_CACHE_KEYSIZE)
+		return DatumGetObjectId(DirectFunctionCall1(regprocedurein,
+							CStringGetDatum(signature)));
+
+	search_path = GetConfigOption("search_path", false, false);
+	if (search_path == NULL)
+		search_path = "";
+
+	if (fnoid_cache && strcmp(fnoid_cache_search_path, search_path) != 0)
+		fnoid_cache_callback((Datum) 0, PROCOID, 0);
+
+	if (fnoid_cache)
+	{
+		entry = (FnoidCacheEntry *) hash_search(fnoid_cache, signature, HASH_FIND, NULL);
+		if (entry)
+			return entry->fnoid;
+	}
+
+	fnoid = DatumGetObjectId(DirectFunctionCall1(regprocedurein,
+							CStringGetDatum(signature)));
+
+	/* the cache can be reset by invalidation processed by regprocedurein */
+	if (!fnoid_cache)
+	{
+		HASHCTL		ctl;
+
+		if (!fnoid_cache_callback_registered)
+		{
+			CacheRegisterSyscacheCallback(PROCOID, fnoid_cache_callback, (Datum) 0);
+			fnoid_cache_callback_registered = true;
+		}
+
+		memset(&ctl, 0, sizeof(ctl));
+		ctl.keysize = FNOID_CACHE_KEYSIZE;
+		ctl.entrysize = sizeof(FnoidCacheEntry);
+
+		fnoid_cache = hash_create("orafce call stack functions", 64, &ctl, HASH_ELEM);
+
+		if (fnoid_cache_search_path)
+			pfree(fnoid_cache_search_path);
+		fnoid_cache_search_path = MemoryContextStrdup(TopMemoryContext, search_path);
+	}
+
+	entry = (FnoidCacheEntry *) hash_search(fnoid_cache, signature, HASH_ENTER, NULL);
+	entry->fnoid = fnoid;
+
+	return fnoid;
+}
+
+/*
+ * Returns lines of error context as array of frames. The signatures of
+ * functions are resolved only when resolve is true.
+ */
+static int
+get_call_stack(CallStackFrame **result, bool resolve)
 {
 	MemoryContext oldcontext = CurrentMemoryContext;
 	ErrorData *edata;
 	ErrorContextCallback *econtext;
-	StringInfo   sinfo;
+	CallStackFrame *frames;
+	int			nframes = 0;
+	int			maxframes = 16;
 
 	errstart(ERROR, __FILE__, __LINE__, PG_FUNCNAME_MACRO, TEXTDOMAIN);
 
@@ -59,26 +239,27 @@ dbms_utility_format_call_stack(char mode)
 	/* Now I wont to parse edata->context to more traditional format */
 	/* I am not sure about order */
 
-	sinfo = makeStringInfo();
-
-	switch (mode)
-	{
-		case 'o':
-			appendStringInfoString(sinfo, "----- PL/pgSQL Call Stack -----\n");
-			appendStringInfoString(sinfo, "  object     line  object\n");
-			appendStringInfoString(sinfo, "  handle   number  name\n");
-			break;
-	}
+	frames = (CallStackFrame *) palloc(maxframes * sizeof(CallStackFrame));
 
 	if (edata->context)
 	{
 		char *start = edata->context;
 		while (*start)
 		{
-			char *oname =  "anonymous object";
-			char *line  = "";
+			CallStackFrame *frame;
 			char *eol = strchr(start, '\n');
-			Oid fnoid = InvalidOid;
+
+			if (nframes == maxframes)
+			{
+				maxframes *= 2;
+				frames = (CallStackFrame *) repalloc(frames, maxframes * sizeof(CallStackFrame));
+			}
+
+			frame = &frames[nframes++];
+			frame->plpgsql = false;
+			frame->fnoid = InvalidOid;
+			frame->line = "";
+			frame->oname = "anonymous object";
 
 			/* first, solve multilines */
 			if (eol)
@@ -89,6 +270,8 @@ dbms_utility_format_call_stack(char mode)
 			{
 				char *p1, *p2;
 
+				frame->plpgsql = true;
+
 				if ((p1 = strstr(start, "function \"")))
 				{
 					p1 += strlen("function \"");
@@ -96,7 +279,7 @@ dbms_utility_format_call_stack(char mode)
 					if ((p2 = strchr(p1, '"')))
 					{
 						*p2++ = '\0';
-						oname = p1;
+						frame->oname = p1;
 						start = p2;
 					}
 				}
@@ -109,9 +292,9 @@ dbms_utility_format_call_stack(char mode)
 						char c = *++p2;
 						*p2 = '\0';
 
-						oname = pstrdup(p1);
-						fnoid = DatumGetObjectId(DirectFunctionCall1(regprocedurein,
-							CStringGetDatum(oname)));
+						frame->oname = pstrdup(p1);
+						if (resolve)
+							frame->fnoid = get_fnoid(frame->oname);
 						*p2 = c;
 						start = p2;
 					}
@@ -130,35 +313,65 @@ dbms_utility_format_call_stack(char mode)
 					c = p1[p2i];
 
 					p1[p2i] = '\0';
-					line = pstrdup(p1);
+					frame->line = pstrdup(p1);
 					p1[p2i] = c;
 				}
 			}
 
-			switch (mode)
-			{
-				case 'o':
-					appendStringInfo(sinfo, "%8x    %5s  function %s", (int)fnoid, line, oname);
-					break;
-
-				case 'p':
-					appendStringInfo(sinfo, "%8d    %5s  function %s", (int)fnoid, line, oname);
-					break;
-
-				case 's':
-					appendStringInfo(sinfo, "%d,%s,%s", (int)fnoid, line, oname);
-					break;
-			}
-
 			if (eol)
-			{
 				start = eol + 1;
-				appendStringInfoChar(sinfo, '\n');
-			}
 			else
 				break;
 		}
+	}
+
+	*result = frames;
+
+	return nframes;
+}
+
+static char*
+dbms_utility_format_call_stack(char mode)
+{
+	CallStackFrame *frames;
+	int			nframes;
+	int			i;
+	StringInfo   sinfo;
+
+	nframes = get_call_stack(&frames, true);
 
+	sinfo = makeStringInfo();
+
+	switch (mode)
+	{
+		case 'o':
+			appendStringInfoString(sinfo, "----- PL/pgSQL Call Stack -----\n");
+			appendStringInfoString(sinfo, "  object     line  object\n");
+			appendStringInfoString(sinfo, "  handle   number  name\n");
+			break;
+	}
+
+	for (i = 0; i < nframes; i++)
+	{
+		CallStackFrame *frame = &frames[i];
+
+		if (i > 0)
+			appendStringInfoChar(sinfo, '\n');
+
+		switch (mode)
+		{
+			case 'o':
+				appendStringInfo(sinfo, "%8x    %5s  function %s", (int)frame->fnoid, frame->line, frame->oname);
+				break;
+
+			case 'p':
+				appendStringInfo(sinfo, "%8d    %5s  function %s", (int)frame->fnoid, frame->line, frame->oname);
+				break;
+
+			case 's':
+				appendStringInfo(sinfo, "%d,%s,%s", (int)frame->fnoid, frame->line, frame->oname);
+				break;
+		}
 	}
 
 	return sinfo->data;
@@ -199,3 +412,152 @@ dbms_utility_format_call_stack1(PG_FUNCTION_ARGS)
 
 	PG_RETURN_TEXT_P(cstring_to_text(dbms_utility_format_call_stack(mode)));
 }
+
+/*
+ * Returns number of PL/pgSQL frames on the call stack, without
+ * resolving of function names.
+ */
+Datum
+dbms_utility_call_stack_depth(PG_FUNCTION_ARGS)
+{
+	CallStackFrame *frames;
+	int			nframes;
+	int			depth = 0;
+	int			i;
+	ContextCallbackFunc plpgsql_callback;
+
+	plpgsql_callback = get_plpgsql_error_callback();
+
+	if (plpgsql_callback)
+	{
+		ErrorContextCallback *econtext;
+
+		for (econtext = error_context_stack;
+			 econtext != NULL;
+			 econtext = econtext->previous)
+			if (econtext->callback == plpgsql_callback)
+				depth++;
+
+		PG_RETURN_INT32(depth);
+	}
+
+	nframes = get_call_stack(&frames, false);
+
+	for (i = 0; i < nframes; i++)
+		if (frames[i].plpgsql)
+			depth++;
+
+	PG_RETURN_INT32(depth);
+}
+
+/*
+ * Returns PL/pgSQL frames as table (depth, func, lineno), depth 1 is
+ * the caller of this function.
+ */
+Datum
+dbms_utility_call_stack(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo	   *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc			tupdesc;
+	Tuplestorestate	   *tupstore;
+	MemoryContext		oldcontext;
+	CallStackFrame	   *frames = NULL;
+	int					nframes = 0;
+	int					depth = 0;
+	int					i;
+	ContextCallbackFunc	plpgsql_callback;
+
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not allowed in this context")));
+
+	plpgsql_callback = get_plpgsql_error_callback();
+
+	if (!plpgsql_callback)
+		nframes = get_call_stack(&frames, true);
+
+	oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+
+	tupdesc = CreateTemplateTupleDesc(3, false);
+
+	TupleDescInitEntry(tupdesc, 1, "depth",  INT4OID, -1, 0);
+	TupleDescInitEntry(tupdesc, 2, "func",   OIDOID,  -1, 0);
+	TupleDescInitEntry(tupdesc, 3, "lineno", INT4OID, -1, 0);
+
+	tupstore = tuplestore_begin_heap((rsinfo->allowedModes & SFRM_Materialize_Random) != 0,
+									 false, work_mem);
+
+	MemoryContextSwitchTo(oldcontext);
+
+#ifdef ORAFCE_PLPGSQL_PLUGIN
+
+	if (plpgsql_callback)
+	{
+		ErrorContextCallback *econtext;
+
+		for (econtext = error_context_stack;
+			 econtext != NULL;
+			 econtext = econtext->previous)
+		{
+			PLpgSQL_execstate *estate;
+			Datum		values[3];
+			bool		nulls[3];
+
+			if (econtext->callback != plpgsql_callback)
+				continue;
+
+			estate = (PLpgSQL_execstate *) econtext->arg;
+
+			memset(nulls, 0, sizeof(nulls));
+
+			values[0] = Int32GetDatum(++depth);
+			values[1] = ObjectIdGetDatum(estate->func->fn_oid);
+			values[2] = Int32GetDatum(estate->err_stmt ? estate->err_stmt->lineno : 0);
+
+			/* inline code block has not oid */
+			if (!OidIsValid(estate->func->fn_oid))
+				nulls[1] = true;
+			if (estate->err_stmt == NULL)
+				nulls[2] = true;
+
+			tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+		}
+	}
+
+#endif
+
+	for (i = 0; i < nframes; i++)
+	{
+		CallStackFrame *frame = &frames[i];
+		Datum		values[3];
+		bool		nulls[3];
+
+		if (!frame->plpgsql)
+			continue;
+
+		memset(nulls, 0, sizeof(nulls));
+
+		values[0] = Int32GetDatum(++depth);
+		values[1] = ObjectIdGetDatum(frame->fnoid);
+		values[2] = Int32GetDatum(atoi(frame->line));
+
+		if (!OidIsValid(frame->fnoid))
+			nulls[1] = true;
+		if (*frame->line == '\0')
+			nulls[2] = true;
+
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+
+	return (Datum) 0;
+}